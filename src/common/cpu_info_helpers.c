@@ -30,19 +30,136 @@
 #include <stdbool.h>
 #include <dirent.h>
 #include <limits.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include "cpu_info_helpers.h"
+#include "cpu_topology.h"
+
+/*
+ * Per cpu sysfs attribute cache
+ *
+ * The attributes below are read over and over for every thread of the
+ * system, e.g. while computing the SMT state. Each one is opened once
+ * and then re-read with pread().
+ */
+enum {
+	CPU_ATTR_ONLINE,
+	CPU_ATTR_PHYSICAL_ID,
+	CPU_ATTR_MAX
+};
+
+static const char * const cpu_attr_names[CPU_ATTR_MAX] = {
+	[CPU_ATTR_ONLINE]	= "online",
+	[CPU_ATTR_PHYSICAL_ID]	= "physical_id",
+};
+
+static struct {
+	int	nr_cpus;
+	int	(*fds)[CPU_ATTR_MAX];	/* -1 if not opened */
+	int	online_readable;	/* -1 until checked */
+} cpu_attrs = {
+	.online_readable = -1,
+};
+
+/**
+ * cpu_attr_cache_init
+ * @brief Size the sysfs attribute cache for the threads of the system
+ *
+ * This is optional, the cache grows as needed, but must be called before
+ * the cache is shared between several threads.
+ *
+ * @param threads_in_system number of threads in the system
+ * @returns 0 on success, -1 otherwise
+ */
+int cpu_attr_cache_init(int threads_in_system)
+{
+	int (*fds)[CPU_ATTR_MAX];
+	int i, j;
+
+	if (threads_in_system <= cpu_attrs.nr_cpus)
+		return 0;
+
+	fds = realloc(cpu_attrs.fds, threads_in_system * sizeof(*fds));
+	if (!fds)
+		return -1;
+
+	for (i = cpu_attrs.nr_cpus; i < threads_in_system; i++)
+		for (j = 0; j < CPU_ATTR_MAX; j++)
+			fds[i][j] = -1;
+
+	cpu_attrs.fds = fds;
+	cpu_attrs.nr_cpus = threads_in_system;
+	return 0;
+}
+
+static int cpu_attr_open(int thread, int attr)
+{
+	char path[SYSFS_PATH_MAX];
+
+	sprintf(path, SYSFS_CPUDIR"/%s", thread, cpu_attr_names[attr]);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/**
+ * get_cpu_attribute
+ * @brief Read a cached per cpu sysfs attribute
+ *
+ * Missing attributes are not cached so that hot added cpus are seen.
+ *
+ * @param thread logical cpu number
+ * @param attr attribute to read
+ * @param value the attribute value
+ * @returns 0 on success, -1 otherwise with errno set
+ */
+static int get_cpu_attribute(int thread, int attr, int *value)
+{
+	char buf[32];
+	ssize_t len;
+	int *fd;
+
+	if (thread < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (thread >= cpu_attrs.nr_cpus &&
+	    cpu_attr_cache_init(thread + 1))
+		return -1;
+
+	fd = &cpu_attrs.fds[thread][attr];
+	if (*fd < 0) {
+		*fd = cpu_attr_open(thread, attr);
+		if (*fd < 0)
+			return -1;
+	}
+
+	len = pread(*fd, buf, sizeof(buf) - 1, 0);
+	if (len < 0 && errno == ENODEV) {
+		/* The cpu has been removed and may be back, reopen it */
+		close(*fd);
+		*fd = cpu_attr_open(thread, attr);
+		if (*fd < 0)
+			return -1;
+		len = pread(*fd, buf, sizeof(buf) - 1, 0);
+	}
+
+	if (len <= 0) {
+		if (len == 0)
+			errno = EIO;
+		return -1;
+	}
+
+	buf[len] = '\0';
+	*value = strtol(buf, NULL, 10);
+	return 0;
+}
 
 int get_attribute(char *path, const char *fmt, int *value)
 {
 	FILE *fp;
 	int rc;
 
-	rc = access(path, F_OK);
-	if (rc)
-		return -1;
-
 	fp = fopen(path, "r");
 	if (!fp)
 		return -1;
@@ -85,25 +202,21 @@ int __sysattr_is_writeable(char *attribute, int threads_in_system)
 
 int cpu_physical_id(int thread)
 {
-	char path[SYSFS_PATH_MAX];
 	int rc, physical_id;
 
-	sprintf(path, SYSFS_CPUDIR"/physical_id", thread);
-	rc = get_attribute(path, "%d", &physical_id);
+	rc = get_cpu_attribute(thread, CPU_ATTR_PHYSICAL_ID, &physical_id);
 
 	/* This attribute does not exist in kernels without hotplug enabled */
-	if (rc && errno == ENOENT)
+	if (rc)
 		return -1;
 	return physical_id;
 }
 
 int cpu_online(int thread)
 {
-	char path[SYSFS_PATH_MAX];
 	int rc, online;
 
-	sprintf(path, SYSFS_CPUDIR"/online", thread);
-	rc = get_attribute(path, "%d", &online);
+	rc = get_cpu_attribute(thread, CPU_ATTR_ONLINE, &online);
 
 	/* This attribute does not exist in kernels without hotplug enabled */
 	if (rc && errno == ENOENT)
@@ -173,6 +286,9 @@ int get_cpu_info(int *_threads_per_cpu, int *_cpus_in_system,
 		cpus_in_system *= subcores;
 	}
 
+	/* Failing here is harmless, the cache grows on first use */
+	cpu_attr_cache_init(threads_in_system);
+
 	*_threads_per_cpu = threads_per_cpu;
 	*_threads_in_system = threads_in_system;
 	*_cpus_in_system = cpus_in_system;
@@ -191,7 +307,12 @@ int __get_one_smt_state(int core, int threads_per_cpu)
 	int smt_state = 0;
 	int i;
 
-	if (!__sysattr_is_readable("online", threads_per_cpu)) {
+	/* The permissions of the online files don't change under us */
+	if (cpu_attrs.online_readable == -1)
+		cpu_attrs.online_readable =
+			__sysattr_is_readable("online", threads_per_cpu);
+
+	if (!cpu_attrs.online_readable) {
 		perror("Cannot retrieve smt state");
 		return -2;
 	}
@@ -231,6 +352,7 @@ int __do_smt(bool numeric, int cpus_in_system, int threads_per_cpu,
 	cpu_set_t **cpu_states = NULL;
 	int cpu_state_size = CPU_ALLOC_SIZE(cpus_in_system);
 	int start_cpu = 0, stop_cpu = cpus_in_system;
+	bool use_topology;
 	int rc = 0;
 
 	cpu_states = (cpu_set_t **)calloc(threads_per_cpu, sizeof(cpu_set_t));
@@ -242,8 +364,13 @@ int __do_smt(bool numeric, int cpus_in_system, int threads_per_cpu,
 		CPU_ZERO_S(cpu_state_size, cpu_states[thread]);
 	}
 
+	/* One read of the online cpu list rather than one per thread */
+	use_topology = cpu_topology_update_online() >= 0;
+
 	for (c = start_cpu; c < stop_cpu; c++) {
-		int threads_online = __get_one_smt_state(c, threads_per_cpu);
+		int threads_online = use_topology ?
+			topology_core_online_threads(c, threads_per_cpu) :
+			__get_one_smt_state(c, threads_per_cpu);
 
 		if (threads_online < 0) {
 			rc = threads_online;
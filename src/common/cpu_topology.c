@@ -0,0 +1,472 @@
+/**
+ * @file cpu_topology.c
+ * @brief Bitmap model of the cpu topology
+ *
+ * Copyright (C) IBM Corporation 2024
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include "cpu_topology.h"
+
+#define ATTR_UNREAD	-2
+
+/*
+ * The online cpus and the cpus of each NUMA node are kept in cpu masks
+ * sized for the possible cpus of the system, so that the per thread
+ * questions asked by the tools are bit tests rather than sysfs reads.
+ *
+ * The online mask is refreshed with a single read of the sysfs online
+ * list. The node masks are read on first use and again after the online
+ * cpus changed, the core and chip of a cpu are read the first time they
+ * are asked for.
+ */
+static struct {
+	int		nr_cpus;	/* cpus in each mask */
+	size_t		size;		/* bytes in each mask */
+	cpu_set_t	*online;
+	cpu_set_t	*new_online;	/* the online list is read into it */
+	int		max_online;
+	int		online_fd;
+	char		*buf;
+	size_t		buf_sz;
+	bool		nodes_loaded;
+	int		nr_nodes;
+	cpu_set_t	**node_masks;	/* NULL for missing node ids */
+	int		*cpu_node;	/* -1 if in no node */
+	int		*cpu_core;	/* ATTR_UNREAD until read */
+	int		*cpu_chip;	/* ATTR_UNREAD until read */
+} topo = {
+	.online_fd = -1,
+	.max_online = -1,
+};
+
+/* Read a whole sysfs file into topo.buf, nul terminated */
+static char *read_sysfs_list(int fd)
+{
+	size_t len = 0;
+	ssize_t rc;
+	char *buf;
+
+	while (1) {
+		if (topo.buf_sz - len < 2) {
+			size_t size = topo.buf_sz ? topo.buf_sz * 2 : 256;
+
+			buf = realloc(topo.buf, size);
+			if (!buf)
+				return NULL;
+
+			topo.buf = buf;
+			topo.buf_sz = size;
+		}
+
+		rc = pread(fd, topo.buf + len, topo.buf_sz - len - 1, len);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			return NULL;
+		}
+
+		if (rc == 0)
+			break;
+
+		len += rc;
+	}
+
+	topo.buf[len] = '\0';
+	return topo.buf;
+}
+
+/*
+ * Parse a cpu list, e.g. "0-7,16-23", into mask if not NULL.
+ * Returns the highest cpu listed, which may not fit the mask, or -1.
+ */
+static int parse_cpu_list(const char *list, cpu_set_t *mask)
+{
+	unsigned long first, last;
+	int max_cpu = -1;
+	char *end;
+
+	if (mask)
+		CPU_ZERO_S(topo.size, mask);
+
+	while (*list >= '0' && *list <= '9') {
+		first = last = strtoul(list, &end, 10);
+		if (*end == '-')
+			last = strtoul(end + 1, &end, 10);
+
+		if ((long)last > max_cpu)
+			max_cpu = last;
+
+		for (; mask && first <= last && first < topo.nr_cpus; first++)
+			CPU_SET_S(first, topo.size, mask);
+
+		list = end;
+		if (*list == ',')
+			list++;
+	}
+
+	return max_cpu;
+}
+
+static int nr_possible_cpus(void)
+{
+	char *list = NULL;
+	int fd, max_cpu = -1;
+
+	fd = open(SYSFS_CPU_POSSIBLE, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		list = read_sysfs_list(fd);
+		close(fd);
+	}
+
+	if (list)
+		max_cpu = parse_cpu_list(list, NULL);
+	if (max_cpu < 0)
+		max_cpu = sysconf(_SC_NPROCESSORS_CONF) - 1;
+
+	return max_cpu < 0 ? 1 : max_cpu + 1;
+}
+
+static void free_nodes(void)
+{
+	int i;
+
+	for (i = 0; i < topo.nr_nodes; i++)
+		CPU_FREE(topo.node_masks[i]);
+
+	free(topo.node_masks);
+	topo.node_masks = NULL;
+	topo.nr_nodes = 0;
+	topo.nodes_loaded = false;
+}
+
+/* Size the masks for nr_cpus, forgetting everything known so far */
+static int resize(int nr_cpus)
+{
+	int i;
+
+	free_nodes();
+	CPU_FREE(topo.online);
+	CPU_FREE(topo.new_online);
+	free(topo.cpu_node);
+	free(topo.cpu_core);
+	free(topo.cpu_chip);
+
+	topo.size = CPU_ALLOC_SIZE(nr_cpus);
+	topo.online = CPU_ALLOC(nr_cpus);
+	topo.new_online = CPU_ALLOC(nr_cpus);
+	topo.cpu_node = malloc(nr_cpus * sizeof(*topo.cpu_node));
+	topo.cpu_core = malloc(nr_cpus * sizeof(*topo.cpu_core));
+	topo.cpu_chip = malloc(nr_cpus * sizeof(*topo.cpu_chip));
+	if (!topo.online || !topo.new_online || !topo.cpu_node ||
+	    !topo.cpu_core || !topo.cpu_chip) {
+		topo.nr_cpus = 0;
+		return -1;
+	}
+
+	topo.nr_cpus = nr_cpus;
+	topo.max_online = -1;
+	CPU_ZERO_S(topo.size, topo.online);
+	for (i = 0; i < nr_cpus; i++) {
+		topo.cpu_node[i] = -1;
+		topo.cpu_core[i] = ATTR_UNREAD;
+		topo.cpu_chip[i] = ATTR_UNREAD;
+	}
+
+	return 0;
+}
+
+/**
+ * cpu_topology_update_online
+ * @brief Refresh the online mask with a single read of the online list
+ *
+ * The masks are sized for the possible cpus on first use and grow if a
+ * cpu beyond them comes online. When the online cpus change, the node
+ * masks are reloaded on next use and the core and chip of the cpus that
+ * came or went are read again.
+ *
+ * @returns 1 if the online cpus changed, 0 if not, -1 on error
+ */
+int cpu_topology_update_online(void)
+{
+	bool grown = false;
+	cpu_set_t *tmp;
+	int cpu, max_cpu, rc;
+	char *list;
+
+	if (!topo.nr_cpus && resize(nr_possible_cpus()))
+		return -1;
+
+	if (topo.online_fd < 0) {
+		topo.online_fd = open(SYSFS_CPU_ONLINE, O_RDONLY | O_CLOEXEC);
+		if (topo.online_fd < 0)
+			return -1;
+	}
+
+	list = read_sysfs_list(topo.online_fd);
+	if (!list)
+		return -1;
+
+	max_cpu = parse_cpu_list(list, topo.new_online);
+	if (max_cpu >= topo.nr_cpus) {
+		if (resize(max_cpu + 1))
+			return -1;
+
+		parse_cpu_list(list, topo.new_online);
+		grown = true;
+	}
+
+	rc = grown || !CPU_EQUAL_S(topo.size, topo.online, topo.new_online);
+
+	/* A cpu number reused after DLPAR may be on another core or chip */
+	for (cpu = 0; rc && !grown && cpu < topo.nr_cpus; cpu++) {
+		if (CPU_ISSET_S(cpu, topo.size, topo.online) !=
+		    CPU_ISSET_S(cpu, topo.size, topo.new_online)) {
+			topo.cpu_core[cpu] = ATTR_UNREAD;
+			topo.cpu_chip[cpu] = ATTR_UNREAD;
+		}
+	}
+
+	tmp = topo.online;
+	topo.online = topo.new_online;
+	topo.new_online = tmp;
+	topo.max_online = max_cpu;
+
+	/* Cpus leave the node masks when they go offline */
+	if (rc)
+		free_nodes();
+
+	return rc;
+}
+
+/**
+ * cpu_topology_init
+ * @brief Load the topology, if not already done
+ *
+ * @returns 0 on success, -1 on error
+ */
+int cpu_topology_init(void)
+{
+	if (topo.nr_cpus)
+		return 0;
+
+	return cpu_topology_update_online() < 0 ? -1 : 0;
+}
+
+int topology_nr_cpus(void)
+{
+	return topo.nr_cpus;
+}
+
+int topology_max_online_cpu(void)
+{
+	return topo.max_online;
+}
+
+bool topology_cpu_online(int cpu)
+{
+	return cpu >= 0 && cpu < topo.nr_cpus &&
+	       CPU_ISSET_S(cpu, topo.size, topo.online);
+}
+
+/**
+ * topology_core_online_threads
+ * @brief Number of online threads of a core, i.e. its SMT state
+ *
+ * @param core core number
+ * @param threads_per_core threads of each core
+ * @returns the number of online threads
+ */
+int topology_core_online_threads(int core, int threads_per_core)
+{
+	int cpu = core * threads_per_core;
+	int last = cpu + threads_per_core;
+	int online = 0;
+
+	for (; cpu < last; cpu++)
+		online += topology_cpu_online(cpu);
+
+	return online;
+}
+
+int topology_nr_online_cores(int nr_cores, int threads_per_core)
+{
+	int core, online = 0;
+
+	for (core = 0; core < nr_cores; core++) {
+		if (topology_core_online_threads(core, threads_per_core))
+			online++;
+	}
+
+	return online;
+}
+
+static int load_nodes(void)
+{
+	char path[PATH_MAX];
+	struct dirent *de;
+	cpu_set_t *mask;
+	int cpu, fd, node, max_node = -1;
+	char *list;
+	DIR *d;
+
+	if (topo.nodes_loaded)
+		return 0;
+
+	if (cpu_topology_init())
+		return -1;
+
+	for (cpu = 0; cpu < topo.nr_cpus; cpu++)
+		topo.cpu_node[cpu] = -1;
+
+	/* Without NUMA support no cpu is in any node */
+	d = opendir(SYSFS_NODEDIR);
+	if (!d) {
+		topo.nodes_loaded = true;
+		return 0;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (sscanf(de->d_name, "node%d", &node) == 1 &&
+		    node > max_node)
+			max_node = node;
+	}
+
+	if (max_node >= 0) {
+		topo.node_masks = calloc(max_node + 1,
+					 sizeof(*topo.node_masks));
+		if (!topo.node_masks) {
+			closedir(d);
+			return -1;
+		}
+		topo.nr_nodes = max_node + 1;
+	}
+
+	rewinddir(d);
+	while ((de = readdir(d)) != NULL) {
+		if (sscanf(de->d_name, "node%d", &node) != 1 ||
+		    node > max_node || topo.node_masks[node])
+			continue;
+
+		mask = CPU_ALLOC(topo.nr_cpus);
+		if (!mask) {
+			closedir(d);
+			free_nodes();
+			return -1;
+		}
+
+		topo.node_masks[node] = mask;
+		CPU_ZERO_S(topo.size, mask);
+
+		snprintf(path, sizeof(path), SYSFS_NODEDIR "/node%d/cpulist",
+			 node);
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			continue;
+
+		list = read_sysfs_list(fd);
+		close(fd);
+		if (!list)
+			continue;
+
+		parse_cpu_list(list, mask);
+		for (cpu = 0; cpu < topo.nr_cpus; cpu++) {
+			if (CPU_ISSET_S(cpu, topo.size, mask))
+				topo.cpu_node[cpu] = node;
+		}
+	}
+
+	closedir(d);
+	topo.nodes_loaded = true;
+	return 0;
+}
+
+int topology_cpu_node(int cpu)
+{
+	if (load_nodes() || cpu < 0 || cpu >= topo.nr_cpus)
+		return -1;
+
+	return topo.cpu_node[cpu];
+}
+
+/* Read a sysfs topology attribute of a cpu once, caching it in cache */
+static int read_cpu_attr(int *cache, int cpu, const char *attr)
+{
+	char path[PATH_MAX], buf[32];
+	ssize_t len;
+	int fd;
+
+	if (cpu < 0 || cpu >= topo.nr_cpus)
+		return -1;
+
+	if (cache[cpu] != ATTR_UNREAD)
+		return cache[cpu];
+
+	cache[cpu] = -1;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, attr);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len > 0) {
+		buf[len] = '\0';
+		cache[cpu] = atoi(buf);
+	}
+
+	return cache[cpu];
+}
+
+/**
+ * topology_cpu_core
+ * @brief Core id of a cpu, as reported by sysfs
+ *
+ * @param cpu logical cpu number
+ * @returns the core id, -1 if unknown
+ */
+int topology_cpu_core(int cpu)
+{
+	/* The cache is only allocated once the topology is loaded */
+	if (cpu_topology_init())
+		return -1;
+
+	return read_cpu_attr(topo.cpu_core, cpu, "core_id");
+}
+
+/**
+ * topology_cpu_chip
+ * @brief Chip, i.e. physical package, of a cpu
+ *
+ * @param cpu logical cpu number
+ * @returns the chip id, -1 if unknown
+ */
+int topology_cpu_chip(int cpu)
+{
+	if (cpu_topology_init())
+		return -1;
+
+	return read_cpu_attr(topo.cpu_chip, cpu, "physical_package_id");
+}
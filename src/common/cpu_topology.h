@@ -0,0 +1,42 @@
+/**
+ * @file cpu_topology.h
+ * @brief Header of the bitmap model of the cpu topology
+ *
+ * Copyright (C) IBM Corporation 2024
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _CPU_TOPOLOGY_H
+#define _CPU_TOPOLOGY_H
+
+#include <sched.h>
+#include <stdbool.h>
+
+#define SYSFS_CPU_POSSIBLE	"/sys/devices/system/cpu/possible"
+#define SYSFS_CPU_ONLINE	"/sys/devices/system/cpu/online"
+#define SYSFS_NODEDIR		"/sys/devices/system/node"
+
+extern int cpu_topology_init(void);
+extern int cpu_topology_update_online(void);
+extern int topology_nr_cpus(void);
+extern int topology_max_online_cpu(void);
+extern bool topology_cpu_online(int cpu);
+extern int topology_core_online_threads(int core, int threads_per_core);
+extern int topology_nr_online_cores(int nr_cores, int threads_per_core);
+extern int topology_cpu_node(int cpu);
+extern int topology_cpu_core(int cpu);
+extern int topology_cpu_chip(int cpu);
+
+#endif /* _CPU_TOPOLOGY_H */
@@ -0,0 +1,179 @@
+/**
+ * @file interval_timer.c
+ * @brief Common routines to pace periodic reports
+ *
+ * Reports are paced against absolute CLOCK_MONOTONIC deadlines so the time
+ * spent sampling and printing does not accumulate as drift.
+ *
+ * Copyright (C) IBM Corporation 2024
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include "interval_timer.h"
+
+/**
+ * parse_interval
+ * @brief Parse an interval given on the command line
+ *
+ * The interval is in seconds, may be fractional ("0.1") and may carry an
+ * explicit "s" or "ms" suffix ("100ms").
+ *
+ * @param arg interval string
+ * @param interval_ms returns the interval in milliseconds
+ * @returns 0 on success, -1 if the interval is not valid
+ */
+int parse_interval(const char *arg, long long *interval_ms)
+{
+	double value, scale = 1000;
+	char *end;
+
+	errno = 0;
+	value = strtod(arg, &end);
+	if (errno || end == arg || !(value >= 0))
+		return -1;
+
+	if (!strcmp(end, "ms"))
+		scale = 1;
+	else if (*end != '\0' && strcmp(end, "s"))
+		return -1;
+
+	value *= scale;
+	if (value > LLONG_MAX / NSEC_PER_MSEC)
+		return -1;
+
+	*interval_ms = value + 0.5;
+
+	/* Refuse intervals that round down to "no interval" */
+	if (value > 0 && *interval_ms == 0)
+		return -1;
+
+	return 0;
+}
+
+/**
+ * clock_ns
+ * @brief Read a clock in nanoseconds
+ *
+ * @param clock clock to read
+ * @returns the time in nanoseconds, -1 on error
+ */
+long long clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts))
+		return -1;
+
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void timespec_add_ns(struct timespec *ts, long long ns)
+{
+	ns += ts->tv_nsec;
+	ts->tv_sec += ns / NSEC_PER_SEC;
+	ts->tv_nsec = ns % NSEC_PER_SEC;
+}
+
+static int timespec_before(struct timespec *a, struct timespec *b)
+{
+	if (a->tv_sec != b->tv_sec)
+		return a->tv_sec < b->tv_sec;
+
+	return a->tv_nsec < b->tv_nsec;
+}
+
+/**
+ * interval_timer_start
+ * @brief Start pacing reports from now
+ *
+ * @param timer timer to start
+ * @param interval_ms interval between reports in milliseconds
+ */
+void interval_timer_start(struct interval_timer *timer, long long interval_ms)
+{
+	timer->interval_ns = interval_ms * NSEC_PER_MSEC;
+	clock_gettime(CLOCK_MONOTONIC, &timer->deadline);
+}
+
+/**
+ * interval_timer_advance
+ * @brief Move to the next deadline without sleeping
+ *
+ * Deadlines that have already passed, because the caller was held up for
+ * longer than an interval, are skipped rather than fired back to back.
+ *
+ * @param timer started interval timer
+ */
+void interval_timer_advance(struct interval_timer *timer)
+{
+	struct timespec now;
+
+	timespec_add_ns(&timer->deadline, timer->interval_ns);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (timespec_before(&timer->deadline, &now))
+		timespec_add_ns(&timer->deadline, timer->interval_ns);
+}
+
+/**
+ * interval_timer_remaining
+ * @brief Time left until the current deadline
+ *
+ * @param timer started interval timer
+ * @returns milliseconds left, rounded up, or 0 once the deadline passed
+ */
+int interval_timer_remaining(struct interval_timer *timer)
+{
+	struct timespec now;
+	long long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (timer->deadline.tv_sec - now.tv_sec) * NSEC_PER_SEC +
+	     timer->deadline.tv_nsec - now.tv_nsec;
+	if (ns <= 0)
+		return 0;
+
+	return (ns + NSEC_PER_MSEC - 1) / NSEC_PER_MSEC;
+}
+
+/**
+ * interval_timer_wait
+ * @brief Sleep until the next report is due
+ *
+ * @param timer started interval timer
+ * @returns 0 on success, -1 with errno set if interrupted or on error
+ */
+int interval_timer_wait(struct interval_timer *timer)
+{
+	int rc;
+
+	if (timer->interval_ns <= 0)
+		return 0;
+
+	interval_timer_advance(timer);
+
+	rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			     &timer->deadline, NULL);
+	if (rc) {
+		errno = rc;
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,42 @@
+/**
+ * @file interval_timer.h
+ * @brief Header of common routines to pace periodic reports
+ *
+ * Copyright (C) IBM Corporation 2024
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _INTERVAL_TIMER_H
+#define _INTERVAL_TIMER_H
+
+#include <time.h>
+
+#define NSEC_PER_SEC	1000000000LL
+#define NSEC_PER_MSEC	1000000LL
+
+struct interval_timer {
+	struct timespec	deadline;	/* CLOCK_MONOTONIC, absolute */
+	long long	interval_ns;
+};
+
+extern int parse_interval(const char *arg, long long *interval_ms);
+extern long long clock_ns(clockid_t clock);
+extern void interval_timer_start(struct interval_timer *timer,
+				 long long interval_ms);
+extern void interval_timer_advance(struct interval_timer *timer);
+extern int interval_timer_remaining(struct interval_timer *timer);
+extern int interval_timer_wait(struct interval_timer *timer);
+
+#endif /* _INTERVAL_TIMER_H */
@@ -441,6 +441,7 @@ add_node(char *path, struct of_node *new_nodes)
 	}
 
 	say(DEBUG, "Adding device-tree node %s\n", path);
+	ofdt_cache_invalidate();
 
 	/* The path passed in is a full ofdt path, remove the preceeding
 	 * /proc/device-tree for the write to the kernel.
@@ -540,6 +541,7 @@ remove_node(const char *path)
 	char buf[DR_PATH_MAX];
 
 	say(DEBUG, "Removing device-tree node %s\n", path);
+	ofdt_cache_invalidate();
 
 	memset(buf, 0, DR_PATH_MAX);
 
@@ -700,6 +702,7 @@ update_property(const char *buf, size_t len)
 	int fd, rc;
 
 	say(DEBUG, "Updating OF property\n");
+	ofdt_cache_invalidate();
 
 	fd = open(OFDTPATH, O_WRONLY);
 	if (fd == -1) {
@@ -719,6 +722,119 @@ update_property(const char *buf, size_t len)
 	return rc;
 }
 
+/*
+ * Device-tree property cache
+ *
+ * drmgr and lsslot look at the same /proc/device-tree properties over
+ * and over, each lookup costing a stat, an open and a read. Properties
+ * are kept here, keyed by their full path, once they have been read.
+ * Missing properties are remembered as well. The whole cache is dropped
+ * as soon as the device tree is changed, see ofdt_cache_invalidate().
+ */
+#define OFDT_CACHE_BUCKETS	1024
+
+struct ofdt_prop {
+	struct ofdt_prop *next;
+	int size;		/* -1 if the property does not exist */
+	char *value;
+	char path[];
+};
+
+static struct ofdt_prop *ofdt_cache[OFDT_CACHE_BUCKETS];
+
+static unsigned int ofdt_cache_hash(const char *path)
+{
+	unsigned int hash = 5381;
+
+	while (*path)
+		hash = hash * 33 + (unsigned char)*path++;
+
+	return hash & (OFDT_CACHE_BUCKETS - 1);
+}
+
+/**
+ * ofdt_cache_invalidate
+ * @brief Drop all the cached device-tree properties
+ *
+ * Must be called whenever the device tree may have been changed.
+ */
+void ofdt_cache_invalidate(void)
+{
+	struct ofdt_prop *prop, *next;
+	int i;
+
+	for (i = 0; i < OFDT_CACHE_BUCKETS; i++) {
+		for (prop = ofdt_cache[i]; prop; prop = next) {
+			next = prop->next;
+			free(prop);
+		}
+		ofdt_cache[i] = NULL;
+	}
+}
+
+/**
+ * ofdt_cache_lookup
+ * @brief Find a device-tree property, reading it on first use
+ *
+ * @param path full path of the property
+ * @returns cached property, NULL if the property can't be cached
+ */
+static struct ofdt_prop *ofdt_cache_lookup(const char *path)
+{
+	struct ofdt_prop *prop;
+	struct stat sb;
+	unsigned int hash;
+	size_t len;
+	ssize_t rc;
+	int fd;
+
+	if (strncmp(path, OFDT_BASE "/", strlen(OFDT_BASE "/")))
+		return NULL;
+
+	hash = ofdt_cache_hash(path);
+	for (prop = ofdt_cache[hash]; prop; prop = prop->next) {
+		if (!strcmp(prop->path, path))
+			return prop;
+	}
+
+	len = strlen(path) + 1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno != ENOENT)
+			return NULL;
+		sb.st_size = 0;
+	} else if (fstat(fd, &sb) || !S_ISREG(sb.st_mode)) {
+		close(fd);
+		return NULL;
+	}
+
+	prop = malloc(sizeof(*prop) + len + sb.st_size);
+	if (prop == NULL) {
+		if (fd >= 0)
+			close(fd);
+		return NULL;
+	}
+
+	memcpy(prop->path, path, len);
+	prop->value = prop->path + len;
+	prop->size = -1;
+
+	if (fd >= 0) {
+		rc = read(fd, prop->value, sb.st_size);
+		close(fd);
+		if (rc != sb.st_size) {
+			free(prop);
+			return NULL;
+		}
+		prop->size = sb.st_size;
+	}
+
+	prop->next = ofdt_cache[hash];
+	ofdt_cache[hash] = prop;
+	return prop;
+}
+
 /**
  * get_att_prop
  * @brief find the value for a given property/attribute.
@@ -746,6 +862,20 @@ get_att_prop(const char *path, const char *name, char *buf, size_t buf_sz,
 	else
 		sprintf(dir, "%s", path);
 
+	if (attr_type == NULL) {
+		struct ofdt_prop *prop = ofdt_cache_lookup(dir);
+
+		if (prop) {
+			/* Empty properties were never read successfully */
+			if (prop->size <= 0 || prop->size > buf_sz)
+				return -1;
+
+			memset(buf, 0, buf_sz);
+			memcpy(buf, prop->value, prop->size);
+			return 0;
+		}
+	}
+
 	fp = fopen(dir, "r");
 	if (fp == NULL)
 		return -1;
@@ -869,6 +999,7 @@ int
 get_property_size(const char *path, const char *property)
 {
 	char dir[DR_PATH_MAX];
+	struct ofdt_prop *prop;
 	struct stat sb;
 
 	if (property != NULL)
@@ -876,7 +1007,12 @@ get_property_size(const char *path, const char *property)
 	else
 		sprintf(dir, "%s", path);
 
-	stat(dir, &sb);
+	prop = ofdt_cache_lookup(dir);
+	if (prop)
+		return (prop->size < 0) ? 0 : prop->size;
+
+	if (stat(dir, &sb))
+		return 0;
 	return sb.st_size;
 }
 
@@ -1534,6 +1670,7 @@ int do_kernel_dlpar_common(const char *cmd, int cmdlen, int silent_error)
 	int rc;
 
 	say(DEBUG, "Initiating kernel DLPAR \"%s\"\n", cmd);
+	ofdt_cache_invalidate();
 
 	/* write to file */
 	if (fd == -1) {
@@ -278,6 +278,65 @@ update_cpu_node(struct dr_node *cpu, const char *path, struct dr_info *dr_info)
 	return 0;
 }
 
+/**
+ * update_cpu_nodes
+ * @brief Update the cpu information of a set of cpus just added
+ *
+ * The device tree nodes of the whole set are located in a single scan
+ * of CPU_OFDT_BASE rather than one scan per cpu.
+ *
+ * @param cpus cpus to update
+ * @param nr number of cpus
+ * @param dr_info cpu drc information
+ */
+static void
+update_cpu_nodes(struct dr_node **cpus, int nr, struct dr_info *dr_info)
+{
+	char path[DR_PATH_MAX];
+	uint32_t my_drc_index;
+	struct dirent *de;
+	int *found;
+	DIR *d;
+	int i;
+
+	found = zalloc(nr * sizeof(*found));
+	if (!found)
+		return;
+
+	d = opendir(CPU_OFDT_BASE);
+	while (d && (de = readdir(d)) != NULL) {
+		if ((de->d_type != DT_DIR) || is_dot_dir(de->d_name))
+			continue;
+
+		if (strncmp(de->d_name, "PowerPC", 7))
+			continue;
+
+		sprintf(path, "%s/%s", CPU_OFDT_BASE, de->d_name);
+
+		if (get_my_drc_index(path, &my_drc_index))
+			continue;
+
+		for (i = 0; i < nr; i++) {
+			if (!found[i] && cpus[i]->drc_index == my_drc_index) {
+				update_cpu_node(cpus[i], path, dr_info);
+				found[i] = 1;
+				break;
+			}
+		}
+	}
+
+	if (d)
+		closedir(d);
+
+	/* Let the per cpu lookup report the nodes that were not found */
+	for (i = 0; i < nr; i++) {
+		if (!found[i])
+			update_cpu_node(cpus[i], NULL, dr_info);
+	}
+
+	free(found);
+}
+
 /**
  * init_cpu_info
  * @brief Initialize cpu information
@@ -613,16 +672,16 @@ refresh_cache_info(struct dr_info *dr_info)
 }
 
 /**
- * acquire_cpu
+ * acquire_cpu_nodes
  *
- * Acquire a new cpu for this partition from the hypervisor.
- * If drc_index is zero, look up an available index to use.
+ * Acquire a new cpu for this partition from the hypervisor and add
+ * its nodes to the device tree.
  *
- * @param drc_index
- * @returns pointer to cpu_info on success, NULL otherwise
+ * @param cpu
+ * @returns 0 on success, !0 otherwise
  */
 static int
-acquire_cpu(struct dr_node *cpu, struct dr_info *dr_info)
+acquire_cpu_nodes(struct dr_node *cpu)
 {
 	struct of_node *of_nodes;
 	int rc;
@@ -651,6 +710,27 @@ acquire_cpu(struct dr_node *cpu, struct dr_info *dr_info)
 		return rc;
 	}
 
+	return 0;
+}
+
+/**
+ * acquire_cpu
+ *
+ * Acquire a new cpu for this partition from the hypervisor.
+ *
+ * @param cpu
+ * @param dr_info
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+acquire_cpu(struct dr_node *cpu, struct dr_info *dr_info)
+{
+	int rc;
+
+	rc = acquire_cpu_nodes(cpu);
+	if (rc)
+		return rc;
+
 	update_cpu_node(cpu, NULL, dr_info);
 	refresh_cache_info(dr_info);
 
@@ -681,12 +761,32 @@ int do_cpu_kernel_dlpar(struct dr_node *cpu, int action)
 	return do_kernel_dlpar(cmdbuf, offset);
 }
 
+static int
+write_cpu_probe(int probe_file, struct dr_node *cpu)
+{
+	char drc_index[DR_STR_MAX];
+	int write_len;
+	int rc;
+
+	memset(drc_index, 0, DR_STR_MAX);
+	write_len = sprintf(drc_index, "0x%x", cpu->drc_index);
+
+	say(DEBUG, "Probing cpu 0x%x\n", cpu->drc_index);
+	rc = write(probe_file, drc_index, write_len);
+	if (rc != write_len) {
+		say(ERROR, "Probe failed! rc = %x\n", rc);
+		return -1;
+	}
+
+	/* The kernel added the cpu and cache nodes to the device tree */
+	ofdt_cache_invalidate();
+	return 0;
+}
+
 int
 probe_cpu(struct dr_node *cpu, struct dr_info *dr_info)
 {
-	char drc_index[DR_STR_MAX];
 	int probe_file;
-	int write_len;
 	int rc = 0;
 
 	if (kernel_dlpar_exists()) {
@@ -714,17 +814,7 @@ probe_cpu(struct dr_node *cpu, struct dr_info *dr_info)
 				cpu->unusable = 1;
 			}
 		} else {
-			memset(drc_index, 0, DR_STR_MAX);
-			write_len = sprintf(drc_index, "0x%x", cpu->drc_index);
-
-			say(DEBUG, "Probing cpu 0x%x\n", cpu->drc_index);
-			rc = write(probe_file, drc_index, write_len);
-			if (rc != write_len)
-				say(ERROR, "Probe failed! rc = %x\n", rc);
-			else
-				/* reset rc to success */
-				rc = 0;
-
+			rc = write_cpu_probe(probe_file, cpu);
 			close(probe_file);
 		}
 	}
@@ -773,6 +863,71 @@ release_caches(struct dr_node *cpu, struct dr_info *dr_info)
 	return; 
 }
 
+static int
+write_cpu_release(int release_file, struct dr_node *cpu)
+{
+	char *path = cpu->ofdt_path + strlen(OFDT_BASE);
+	int write_len = strlen(path);
+	int rc;
+
+	say(DEBUG, "Releasing cpu \"%s\"\n", path);
+	rc = write(release_file, path, write_len);
+	if (rc != write_len) {
+		say(ERROR, "Release failed! rc = %d\n", rc);
+		return -1;
+	}
+
+	/* The kernel removed the cpu and cache nodes from the device tree */
+	ofdt_cache_invalidate();
+	return 0;
+}
+
+/* Release a cpu on kernels without any DLPAR support */
+static int
+release_cpu_from_user(struct dr_node *cpu, struct dr_info *dr_info)
+{
+	int rc;
+
+	rc = offline_cpu(cpu);
+	if (rc) {
+		say(ERROR, "Could not offline cpu %s\n", cpu->drc_name);
+		return rc;
+	}
+
+	rc = release_drc(cpu->drc_index, CPU_DEV);
+	if (rc) {
+		say(ERROR, "Could not release drc resources for %s\n",
+		    cpu->name);
+		return rc;
+	}
+
+	rc = remove_device_tree_nodes(cpu->ofdt_path);
+	if (rc) {
+		struct of_node *of_nodes;
+
+		say(ERROR, "Could not remove device tree nodes %s\n",
+		    cpu->name);
+
+		of_nodes = configure_connector(cpu->drc_index);
+		if (of_nodes == NULL) {
+			say(ERROR, "Call to configure_connector failed "
+			    "for %s. The device tree\nmay contain "
+			    "invalid data for this cpu and a "
+			    "re-activation of the partition is "
+			    "needed to correct it.\n", cpu->name);
+		} else {
+			rc = add_device_tree_nodes(CPU_OFDT_BASE, of_nodes);
+			free_of_node(of_nodes);
+		}
+
+		acquire_drc(cpu->drc_index);
+		return rc;
+	}
+
+	release_caches(cpu, dr_info);
+	return 0;
+}
+
 /**
  * release_cpu
  *
@@ -797,61 +952,163 @@ release_cpu(struct dr_node *cpu, struct dr_info *dr_info)
 	release_file = open(CPU_RELEASE_FILE, O_WRONLY);
 	if (release_file > 0) {
 		/* DLPAR can be done in kernel */
-		char *path = cpu->ofdt_path + strlen(OFDT_BASE);
-		int write_len = strlen(path);
-
-		say(DEBUG, "Releasing cpu \"%s\"\n", path);
-		rc = write(release_file, path, write_len);
-		if (rc != write_len)
-			say(ERROR, "Release failed! rc = %d\n", rc);
-		else
-			/* set rc to success */
-			rc = 0;
-
+		rc = write_cpu_release(release_file, cpu);
 		close(release_file);
 	} else {
 		/* Must do DLPAR from user-space */
-		rc = offline_cpu(cpu);
+		rc = release_cpu_from_user(cpu, dr_info);
+	}
+
+	return rc;
+}
+
+/**
+ * probe_cpus
+ * @brief Add a set of cpus with one round of requests
+ *
+ * The kernel DLPAR or probe requests of the whole set are written back
+ * to back, before the device tree nodes of the new cpus are located in
+ * a single scan and the cache information is refreshed once. Without
+ * kernel support the drcs of the set are acquired and their connectors
+ * configured first, then the new cpus are onlined.
+ *
+ * The cpus that could not be added are marked unusable. The cpus added
+ * are moved to the start of the array. If drmgr times out, the rest of
+ * the set is left untouched and is not counted in tried.
+ *
+ * @param cpus cpus to add
+ * @param nr number of cpus
+ * @param dr_info cpu drc information
+ * @param tried returns the number of cpus an add was attempted for
+ * @returns the number of cpus added
+ */
+int
+probe_cpus(struct dr_node **cpus, int nr, struct dr_info *dr_info, int *tried)
+{
+	int kernel_dlpar, probe_file = -1;
+	struct dr_node *cpu;
+	int i, added = 0;
+	int rc;
+
+	*tried = 0;
+	kernel_dlpar = kernel_dlpar_exists();
+	if (!kernel_dlpar)
+		probe_file = open(CPU_PROBE_FILE, O_WRONLY | O_CLOEXEC);
+
+	for (i = 0; i < nr; i++) {
+		cpu = cpus[i];
+
+		if (i && drmgr_timed_out())
+			break;
+
+		(*tried)++;
+		if (kernel_dlpar)
+			rc = do_cpu_kernel_dlpar(cpu, ADD);
+		else if (probe_file >= 0)
+			rc = write_cpu_probe(probe_file, cpu);
+		else
+			rc = acquire_cpu_nodes(cpu);
+
 		if (rc) {
-			say(ERROR, "Could not offline cpu %s\n", cpu->drc_name);
-			return rc;
+			say(DEBUG, "Unable to acquire CPU with drc index %x\n",
+			    cpu->drc_index);
+			cpu->unusable = 1;
+			continue;
 		}
 
-		rc = release_drc(cpu->drc_index, CPU_DEV);
-		if (rc) {
-			say(ERROR, "Could not release drc resources for %s\n",
-			    cpu->name);
-			return rc;
+		cpus[added++] = cpu;
+	}
+
+	if (probe_file >= 0)
+		close(probe_file);
+
+	if (!added)
+		return 0;
+
+	update_cpu_nodes(cpus, added, dr_info);
+	refresh_cache_info(dr_info);
+
+	if (kernel_dlpar || probe_file >= 0)
+		return added;
+
+	/* The kernel does not online cpus added from user-space */
+	nr = added;
+	added = 0;
+	for (i = 0; i < nr; i++) {
+		cpu = cpus[i];
+
+		if (online_cpu(cpu, dr_info)) {
+			say(ERROR, "Unable to online %s\n", cpu->drc_name);
+			offline_cpu(cpu);
+			release_cpu_from_user(cpu, dr_info);
+			cpu->is_owned = 0;
+			cpu->unusable = 1;
+			continue;
 		}
 
-		rc = remove_device_tree_nodes(cpu->ofdt_path);
-		if (rc) {
-			struct of_node *of_nodes;
+		cpus[added++] = cpu;
+	}
 
-			say(ERROR, "Could not remove device tree nodes %s\n",
-			    cpu->name);
-		
-			of_nodes = configure_connector(cpu->drc_index);
-			if (of_nodes == NULL) {
-				say(ERROR, "Call to configure_connector failed "
-				    "for %s. The device tree\nmay contain "
-				    "invalid data for this cpu and a "
-				    "re-activation of the partition is "
-				    "needed to correct it.\n", cpu->name);
-			} else {
-				rc = add_device_tree_nodes(CPU_OFDT_BASE,
-							   of_nodes);
-				free_of_node(of_nodes);
-			}
+	return added;
+}
 
-			acquire_drc(cpu->drc_index);
-			return rc;
+/**
+ * release_cpus
+ * @brief Remove a set of cpus with one round of requests
+ *
+ * The kernel DLPAR or release requests of the whole set are written back
+ * to back. A cpu that could not be released is onlined again and marked
+ * unusable. The cpus released are moved to the start of the array and
+ * are no longer owned. If drmgr times out, the rest of the set is left
+ * untouched and is not counted in tried.
+ *
+ * @param cpus cpus to remove
+ * @param nr number of cpus
+ * @param dr_info cpu drc information
+ * @param tried returns the number of cpus a removal was attempted for
+ * @returns the number of cpus removed
+ */
+int
+release_cpus(struct dr_node **cpus, int nr, struct dr_info *dr_info, int *tried)
+{
+	int kernel_dlpar, release_file = -1;
+	struct dr_node *cpu;
+	int i, removed = 0;
+	int rc;
+
+	*tried = 0;
+	kernel_dlpar = kernel_dlpar_exists();
+	if (!kernel_dlpar)
+		release_file = open(CPU_RELEASE_FILE, O_WRONLY | O_CLOEXEC);
+
+	for (i = 0; i < nr; i++) {
+		cpu = cpus[i];
+
+		if (i && drmgr_timed_out())
+			break;
+
+		(*tried)++;
+		if (kernel_dlpar)
+			rc = do_cpu_kernel_dlpar(cpu, REMOVE);
+		else if (release_file >= 0)
+			rc = write_cpu_release(release_file, cpu);
+		else
+			rc = release_cpu_from_user(cpu, dr_info);
+
+		if (rc) {
+			online_cpu(cpu, dr_info);
+			cpu->unusable = 1;
+			continue;
 		}
 
-		release_caches(cpu, dr_info);
+		cpu->is_owned = 0;
+		cpus[removed++] = cpu;
 	}
 
-	return rc;
+	if (release_file >= 0)
+		close(release_file);
+
+	return removed;
 }
 
 
@@ -0,0 +1,286 @@
+/**
+ * @file common_mem.c
+ * @brief Scanner for the state of the sysfs memory blocks
+ *
+ * Copyright (C) IBM Corporation 2024
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#include "dr.h"
+#include "ofdt.h"
+#include "common_numa.h"
+#include "common_mem.h"
+
+/* Scanning fewer blocks than this is not worth starting threads */
+#define MEM_SCAN_MIN_BLOCKS	64
+
+/*
+ * Dense table of the sysfs memory blocks, indexed by block number, and
+ * the list of the block numbers present found by mem_blocks_init().
+ */
+static struct mem_block *mem_blocks;
+static uint32_t nr_mem_blocks;
+static uint32_t *present_blocks;
+static uint32_t nr_present_blocks;
+
+struct mem_scan {
+	uint8_t		attrs;
+	uint32_t	next;		/* next index in present_blocks */
+};
+
+/**
+ * read_block_attr
+ * @brief Read a sysfs attribute of a memory block
+ *
+ * @param block memory block number
+ * @param attr name of the attribute
+ * @param buf buffer to read the attribute into
+ * @param buf_sz size of the buffer
+ * @returns 0 on success, -1 on failure
+ */
+static int read_block_attr(uint32_t block, const char *attr, char *buf,
+			   size_t buf_sz)
+{
+	char path[DR_PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	sprintf(path, "%s/memory%u/%s", MEM_SYSFS_DIR, block, attr);
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	len = read(fd, buf, buf_sz - 1);
+	close(fd);
+	if (len < 0)
+		return -1;
+
+	buf[len] = '\0';
+	return 0;
+}
+
+/**
+ * read_block_node
+ * @brief Find the NUMA node a memory block belongs to
+ *
+ * The node is given by the nodeN link in the memory block directory.
+ *
+ * @param block memory block number
+ * @returns node id, NUMA_NO_NODE if not found
+ */
+static int read_block_node(uint32_t block)
+{
+	char path[DR_PATH_MAX];
+	struct dirent *de;
+	int node = NUMA_NO_NODE;
+	DIR *d;
+
+	sprintf(path, "%s/memory%u", MEM_SYSFS_DIR, block);
+
+	d = opendir(path);
+	if (d == NULL)
+		return NUMA_NO_NODE;
+
+	while ((de = readdir(d)) != NULL) {
+		if (sscanf(de->d_name, "node%d", &node) == 1)
+			break;
+	}
+
+	closedir(d);
+	return node;
+}
+
+/**
+ * scan_block
+ * @brief Read the requested attributes of a memory block not read yet
+ *
+ * @param block memory block number
+ * @param attrs MEM_BLOCK_* attributes to read
+ */
+static void scan_block(uint32_t block, uint8_t attrs)
+{
+	struct mem_block *mb = &mem_blocks[block];
+	char buf[16];
+
+	attrs &= ~mb->scanned;
+
+	if (attrs & MEM_BLOCK_REMOVABLE) {
+		if (!read_block_attr(block, "removable", buf, sizeof(buf)))
+			mb->removable = (atoi(buf) != 0);
+		else
+			mb->removable = 0;
+	}
+
+	if (attrs & MEM_BLOCK_NODE)
+		mb->node = read_block_node(block);
+
+	mb->scanned |= attrs;
+}
+
+static void *scan_worker(void *arg)
+{
+	struct mem_scan *scan = arg;
+	uint32_t i;
+
+	while ((i = __sync_fetch_and_add(&scan->next, 1)) < nr_present_blocks)
+		scan_block(present_blocks[i], scan->attrs);
+
+	return NULL;
+}
+
+/**
+ * mem_blocks_init
+ * @brief Find the sysfs memory blocks present on the system
+ *
+ * This is a single pass over the sysfs memory directory, none of the
+ * memory block attributes are read.
+ *
+ * @returns 0 on success, !0 on failure
+ */
+int mem_blocks_init(void)
+{
+	struct dirent *de;
+	uint32_t block, max_present = 0, max_block = 0;
+	uint32_t i;
+	DIR *d;
+
+	if (mem_blocks)
+		return 0;
+
+	d = opendir(MEM_SYSFS_DIR);
+	if (d == NULL) {
+		say(DEBUG, "Could not open %s\n", MEM_SYSFS_DIR);
+		return -1;
+	}
+
+	while ((de = readdir(d)) != NULL) {
+		if (sscanf(de->d_name, "memory%u", &block) != 1)
+			continue;
+
+		if (nr_present_blocks == max_present) {
+			uint32_t *blocks;
+
+			max_present = max_present ? max_present * 2 : 1024;
+			blocks = realloc(present_blocks,
+					 max_present * sizeof(*blocks));
+			if (blocks == NULL) {
+				say(ERROR, "Could not allocate memory block "
+				    "list\n");
+				closedir(d);
+				return -1;
+			}
+
+			present_blocks = blocks;
+		}
+
+		present_blocks[nr_present_blocks++] = block;
+		if (block > max_block)
+			max_block = block;
+	}
+
+	closedir(d);
+
+	nr_mem_blocks = max_block + 1;
+	mem_blocks = zalloc(nr_mem_blocks * sizeof(*mem_blocks));
+	if (mem_blocks == NULL)
+		return -1;
+
+	for (i = 0; i < nr_mem_blocks; i++)
+		mem_blocks[i].node = NUMA_NO_NODE;
+
+	for (i = 0; i < nr_present_blocks; i++)
+		mem_blocks[present_blocks[i]].present = 1;
+
+	say(DEBUG, "Found %u sysfs memory blocks\n", nr_present_blocks);
+	return 0;
+}
+
+/**
+ * mem_blocks_scan
+ * @brief Read attributes of all of the present memory blocks
+ *
+ * The sysfs reads are spread across a pool of up to MEM_SCAN_THREADS
+ * threads, the calling thread taking part in the scan.  Attributes that
+ * have already been read are not read again.
+ *
+ * @param attrs MEM_BLOCK_* attributes to read
+ * @returns 0 on success, !0 on failure
+ */
+int mem_blocks_scan(uint8_t attrs)
+{
+	pthread_t threads[MEM_SCAN_THREADS - 1];
+	struct mem_scan scan;
+	long nr_threads;
+	int i, started = 0;
+
+	if (mem_blocks_init())
+		return -1;
+
+	scan.attrs = attrs;
+	scan.next = 0;
+
+	nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nr_threads > MEM_SCAN_THREADS)
+		nr_threads = MEM_SCAN_THREADS;
+	if (nr_present_blocks < MEM_SCAN_MIN_BLOCKS)
+		nr_threads = 1;
+
+	for (i = 0; i < nr_threads - 1; i++) {
+		if (pthread_create(&threads[i], NULL, scan_worker, &scan))
+			break;
+		started++;
+	}
+
+	say(DEBUG, "Scanning %u memory blocks with %d threads\n",
+	    nr_present_blocks, started + 1);
+
+	scan_worker(&scan);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	return 0;
+}
+
+/**
+ * mem_block_get
+ * @brief Get the state of a memory block
+ *
+ * Any of the requested attributes that have not been read yet are read
+ * synchronously.
+ *
+ * @param block memory block number
+ * @param attrs MEM_BLOCK_* attributes needed, 0 to only check presence
+ * @returns pointer to the memory block state, NULL if not present
+ */
+struct mem_block *mem_block_get(uint32_t block, uint8_t attrs)
+{
+	if (block >= nr_mem_blocks || !mem_blocks[block].present)
+		return NULL;
+
+	if (attrs & ~mem_blocks[block].scanned)
+		scan_block(block, attrs);
+
+	return &mem_blocks[block];
+}
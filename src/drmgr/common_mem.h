@@ -0,0 +1,46 @@
+/**
+ * @file common_mem.h
+ *
+ * Copyright (C) IBM Corporation 2024
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ */
+#ifndef _COMMON_MEM_H_
+#define _COMMON_MEM_H_
+
+#include <stdint.h>
+
+#define MEM_SYSFS_DIR		"/sys/devices/system/memory"
+
+/* sysfs memory block attributes, see mem_blocks_scan() */
+#define MEM_BLOCK_REMOVABLE	0x01
+#define MEM_BLOCK_NODE		0x02
+
+/* Maximum number of threads reading sysfs memory block attributes */
+#define MEM_SCAN_THREADS	16
+
+/* State of a sysfs memory block, indexed by memory block number */
+struct mem_block {
+	uint8_t		present;
+	uint8_t		scanned;	/* MEM_BLOCK_* attributes read */
+	uint8_t		removable;
+	int		node;		/* NUMA_NO_NODE if not found */
+};
+
+int mem_blocks_init(void);
+int mem_blocks_scan(uint8_t attrs);
+struct mem_block *mem_block_get(uint32_t block, uint8_t attrs);
+
+#endif /* _COMMON_MEM_H_ */
@@ -28,7 +28,8 @@ struct ppcnuma_node {
 	unsigned int	n_cpus;
 	unsigned int	n_lmbs;
 	unsigned int	ratio;
-	struct dr_node	*lmbs;			/* linked by lmb_numa_next */
+	uint32_t	*lmbs;			/* drc indexes, n_lmbs in use */
+	unsigned int	lmbs_sz;		/* allocated size of lmbs */
 	struct ppcnuma_node *ratio_next;
 };
 
@@ -61,6 +61,168 @@ struct drc_info {
 
 struct dr_connector *all_drc_lists = NULL;
 
+/*
+ * DRC registry
+ *
+ * Every dr_connector list read by get_drc_info() is registered here,
+ * its connectors being hashed by drc name and by drc index so that
+ * looking one up does not mean walking the lists. The lists themselves
+ * are found through a hash of their device tree path.
+ */
+#define DRC_HASH_BITS	10
+#define DRC_HASH_SZ	(1 << DRC_HASH_BITS)
+
+struct drc_list_ref;
+
+struct drc_ref {
+	struct dr_connector	*drc;
+	struct drc_list_ref	*list;
+	struct drc_ref		*name_next;
+	struct drc_ref		*index_next;
+};
+
+struct drc_list_ref {
+	struct dr_connector	*list;
+	struct drc_list_ref	*path_next;
+	int			walked;	/* drc_tree_walk() order, 0 if not */
+	struct drc_ref		refs[];
+};
+
+static struct drc_list_ref *drc_path_hash[DRC_HASH_SZ];
+static struct drc_ref *drc_name_hash[DRC_HASH_SZ];
+static struct drc_ref *drc_index_hash[DRC_HASH_SZ];
+static int drc_tree_walked;
+static int drc_walk_seq;
+
+static unsigned int drc_str_hash(const char *str)
+{
+	unsigned int hash = 5381;
+
+	while (*str)
+		hash = hash * 33 + (unsigned char)*str++;
+
+	return hash & (DRC_HASH_SZ - 1);
+}
+
+static unsigned int drc_index_hash_fn(uint32_t index)
+{
+	return (index * 2654435761U) >> (32 - DRC_HASH_BITS);
+}
+
+static struct drc_list_ref *drc_list_lookup(const char *of_path)
+{
+	struct drc_list_ref *lref;
+
+	for (lref = drc_path_hash[drc_str_hash(of_path)]; lref;
+	     lref = lref->path_next) {
+		if (!strcmp(lref->list->ofdt_path, of_path))
+			return lref;
+	}
+
+	return NULL;
+}
+
+/**
+ * register_drc_list
+ * @brief Add a dr_connector list to the DRC registry
+ *
+ * @param list list to register
+ * @returns registry entry for the list, NULL on failure
+ */
+static struct drc_list_ref *register_drc_list(struct dr_connector *list)
+{
+	struct drc_list_ref *lref;
+	struct dr_connector *drc;
+	struct drc_ref *ref;
+	unsigned int hash;
+	int i, n_drcs = 0;
+
+	for (drc = list; drc; drc = drc->next)
+		n_drcs++;
+
+	lref = zalloc(sizeof(*lref) + n_drcs * sizeof(struct drc_ref));
+	if (lref == NULL)
+		return NULL;
+
+	lref->list = list;
+	for (i = 0, drc = list; drc; drc = drc->next, i++)
+		lref->refs[i].drc = drc;
+
+	/* Hash in reverse so that the chains keep the list order */
+	for (i = n_drcs - 1; i >= 0; i--) {
+		ref = &lref->refs[i];
+		ref->list = lref;
+
+		hash = drc_str_hash(ref->drc->name);
+		ref->name_next = drc_name_hash[hash];
+		drc_name_hash[hash] = ref;
+
+		hash = drc_index_hash_fn(ref->drc->index);
+		ref->index_next = drc_index_hash[hash];
+		drc_index_hash[hash] = ref;
+	}
+
+	hash = drc_str_hash(list->ofdt_path);
+	lref->path_next = drc_path_hash[hash];
+	drc_path_hash[hash] = lref;
+
+	return lref;
+}
+
+/**
+ * drc_ref_find
+ * @brief Look a connector up by name or index in the DRC registry
+ *
+ * A connector found in several of the walked lists is returned from the
+ * list drc_tree_walk() found first, as a depth first search of the tree
+ * would.
+ *
+ * @param lref list to search, NULL to search the lists found by
+ *	       drc_tree_walk()
+ * @param search_type DRC_NAME or DRC_INDEX
+ * @param key name or pointer to the index to look for
+ * @returns registry entry of the connector, NULL if not found
+ */
+static struct drc_ref *drc_ref_find(struct drc_list_ref *lref,
+				    int search_type, void *key)
+{
+	struct drc_ref *ref, *found = NULL;
+
+	if (search_type == DRC_NAME) {
+		for (ref = drc_name_hash[drc_str_hash(key)]; ref;
+		     ref = ref->name_next) {
+			if (strcmp(ref->drc->name, (char *)key))
+				continue;
+
+			if (lref) {
+				if (ref->list == lref)
+					return ref;
+			} else if (ref->list->walked && (!found ||
+				   ref->list->walked < found->list->walked)) {
+				found = ref;
+			}
+		}
+	} else {
+		uint32_t index = *(uint32_t *)key;
+
+		for (ref = drc_index_hash[drc_index_hash_fn(index)]; ref;
+		     ref = ref->index_next) {
+			if (ref->drc->index != index)
+				continue;
+
+			if (lref) {
+				if (ref->list == lref)
+					return ref;
+			} else if (ref->list->walked && (!found ||
+				   ref->list->walked < found->list->walked)) {
+				found = ref;
+			}
+		}
+	}
+
+	return found;
+}
+
 /**
  * alloc_node
  *
@@ -489,12 +651,12 @@ get_drc_info(const char *of_path)
 	char ofdt_path[DR_PATH_MAX];
 	char *full_path = NULL;
 	struct dr_connector *list = NULL;
+	struct drc_list_ref *lref;
 	int rc;
 
-	for (list = all_drc_lists; list; list = list->all_next) {
-		if (! strcmp(list->ofdt_path, of_path))
-			return list;
-	}
+	lref = drc_list_lookup(of_path);
+	if (lref)
+		return lref->list;
 
 	full_path = of_to_full_path(of_path);
 	if (full_path == NULL)
@@ -509,6 +671,11 @@ get_drc_info(const char *of_path)
 	else
 		rc = drc_info_connectors_v2(full_path, ofdt_path, &list);
 
+	if (rc == 0 && register_drc_list(list) == NULL) {
+		free(list);
+		rc = -1;
+	}
+
 	if (rc == 0) {
 		list->all_next = all_drc_lists;
 		all_drc_lists = list;
@@ -528,6 +695,20 @@ void
 free_drc_info(void)
 {
 	struct dr_connector *list;
+	struct drc_list_ref *lref;
+	int i;
+
+	for (i = 0; i < DRC_HASH_SZ; i++) {
+		while (drc_path_hash[i]) {
+			lref = drc_path_hash[i];
+			drc_path_hash[i] = lref->path_next;
+			free(lref);
+		}
+		drc_name_hash[i] = NULL;
+		drc_index_hash[i] = NULL;
+	}
+	drc_tree_walked = 0;
+	drc_walk_seq = 0;
 
 	while (all_drc_lists) {
 		list = all_drc_lists;
@@ -554,6 +735,19 @@ search_drc_list(struct dr_connector *drc_list, struct dr_connector *start,
 {
 	struct dr_connector *drc;
 
+	/* Whole list name and index lookups go through the registry */
+	if (!start && drc_list
+	    && (search_type == DRC_NAME || search_type == DRC_INDEX)) {
+		struct drc_list_ref *lref;
+		struct drc_ref *ref;
+
+		lref = drc_list_lookup(drc_list->ofdt_path);
+		if (lref && lref->list == drc_list) {
+			ref = drc_ref_find(lref, search_type, key);
+			return ref ? ref->drc : NULL;
+		}
+	}
+
 	if (start)
 		drc = start;
 	else
@@ -641,10 +835,9 @@ drc_name_to_index(const char *name, struct dr_connector *drc_list)
 {
 	struct dr_connector *drc;
 
-	for (drc = drc_list; drc != NULL; drc = drc->next) {
-		if (!strcmp(name, drc->name))
-			return drc->index;
-	}
+	drc = search_drc_list(drc_list, NULL, DRC_NAME, (void *)name);
+	if (drc)
+		return drc->index;
 
 	return 0; /* hopefully 0 isn't a valid index... */
 }
@@ -661,33 +854,22 @@ drc_index_to_name(uint32_t index, struct dr_connector *drc_list)
 {
 	struct dr_connector *drc;
 
-	for (drc = drc_list; drc != NULL; drc = drc->next) {
-		if (index == drc->index)
-			return drc->name;
-	}
+	drc = search_drc_list(drc_list, NULL, DRC_INDEX, &index);
+	if (drc)
+		return drc->name;
 
 	return NULL;
 }
 
 /**
- * search_drc_by_key
- * @brief Retrieve a dr_connector based on DRC name or DRC index
+ * __search_drc_by_key
+ * @brief Walk the drc lists from start_dir looking for a dr_connector
  *
- * This routine searches the drc lists for a dr_connector with the
- * specified name or index starting at the specified directory. If
- * a dr_connector is found the root_dir that the dr_connector was
- * found in is also filled out.
- *
- * @param key to serach for the dr_connector
- * @param drc pointer to a drc to point to the found dr_connector
- * @param root_dir pointer to buf to fill in with root directory
- * @param start_dir, directory to start searching
- * @param key_type whether the key is DRC name or DRC index
- * @returns 0 on success (drc and root_dir filled in), !0 on failure
+ * See search_drc_by_key() for the parameters.
  */
-int
-search_drc_by_key(void *key, struct dr_connector *drc, char *root_dir,
-		char *start_dir, int key_type)
+static int
+__search_drc_by_key(void *key, struct dr_connector *drc, char *root_dir,
+		    char *start_dir, int key_type)
 {
         struct dr_connector *drc_list = NULL;
         struct dr_connector *drc_entry;
@@ -721,8 +903,8 @@ search_drc_by_key(void *key, struct dr_connector *drc, char *root_dir,
 			continue;
 
 		sprintf(dir_path, "%s/%s", start_dir, de->d_name);
-		rc = search_drc_by_key(key, drc, root_dir, dir_path,
-					key_type);
+		rc = __search_drc_by_key(key, drc, root_dir, dir_path,
+					 key_type);
 		if (rc == 0)
 			break;
 	}
@@ -731,6 +913,87 @@ search_drc_by_key(void *key, struct dr_connector *drc, char *root_dir,
 	return rc;
 }
 
+/**
+ * drc_tree_walk
+ * @brief Register the DRC lists found below a directory
+ *
+ * The directories visited are the ones __search_drc_by_key() would look
+ * at, i.e. the subdirectories of directories holding DRC information.
+ *
+ * @param dir directory to start from
+ */
+static void drc_tree_walk(const char *dir)
+{
+	struct drc_list_ref *lref;
+	struct dirent *de;
+	DIR *d;
+
+	if (get_drc_info(dir) == NULL)
+		return;
+
+	lref = drc_list_lookup(dir);
+	if (lref && !lref->walked)
+		lref->walked = ++drc_walk_seq;
+
+	d = opendir(dir);
+	if (d == NULL)
+		return;
+
+	while ((de = readdir(d)) != NULL) {
+		char dir_path[DR_PATH_MAX];
+
+		if ((de->d_type != DT_DIR) || is_dot_dir(de->d_name))
+			continue;
+
+		sprintf(dir_path, "%s/%s", dir, de->d_name);
+		drc_tree_walk(dir_path);
+	}
+	closedir(d);
+}
+
+/**
+ * search_drc_by_key
+ * @brief Retrieve a dr_connector based on DRC name or DRC index
+ *
+ * This routine searches the drc lists for a dr_connector with the
+ * specified name or index starting at the specified directory. If
+ * a dr_connector is found the root_dir that the dr_connector was
+ * found in is also filled out.
+ *
+ * @param key to serach for the dr_connector
+ * @param drc pointer to a drc to point to the found dr_connector
+ * @param root_dir pointer to buf to fill in with root directory
+ * @param start_dir, directory to start searching
+ * @param key_type whether the key is DRC name or DRC index
+ * @returns 0 on success (drc and root_dir filled in), !0 on failure
+ */
+int
+search_drc_by_key(void *key, struct dr_connector *drc, char *root_dir,
+		char *start_dir, int key_type)
+{
+	struct drc_ref *ref;
+
+	/* Searches from the root are answered from the DRC registry, the
+	 * tree being walked only once.
+	 */
+	if (!strcmp(start_dir, OFDT_BASE)) {
+		if (!drc_tree_walked) {
+			drc_tree_walk(OFDT_BASE);
+			drc_tree_walked = 1;
+		}
+
+		ref = drc_ref_find(NULL, key_type, key);
+		if (ref) {
+			memcpy(drc, ref->drc, sizeof(*drc));
+			sprintf(root_dir, "%s", ref->list->list->ofdt_path);
+			return 0;
+		}
+	}
+
+	/* The device tree may have changed since it was walked */
+	return __search_drc_by_key(key, drc, root_dir, start_dir, key_type);
+}
+
 /**
  * get_drc_by_name
  * @brief Retrieve a dr_connector with the specified drc_name
@@ -240,10 +240,7 @@ add_child_node(struct dr_node *parent, char *child_path)
 	drc_list = get_drc_info(child_path);
 	*slash = '/';
 
-	for (drc = drc_list; drc != NULL; drc = drc->next) {
-		if (drc->index == my_drc_index)
-			break;
-	}
+	drc = search_drc_list(drc_list, NULL, DRC_INDEX, &my_drc_index);
 
 	/* Allocate space for the Open Firmware node information.  */
 	child = alloc_dr_node(drc, parent->dev_type, child_path);
@@ -445,113 +442,166 @@ static inline int is_logical_type(char *type)
 	return (!strcmp(type, "SLOT"));
 }
 
+/*
+ * Sysfs devices are correlated with the device tree through the devspec
+ * attribute of the devices on the buses drmgr handles, indexed by their
+ * device tree path (relative to OFDT_BASE, as found in devspec). This
+ * avoids walking all of /sys/devices.
+ */
+static const char * const devspec_buses[] = {
+	"/sys/bus/pci/devices",
+	"/sys/bus/vio/devices",
+	"/sys/bus/ibmebus/devices",
+};
+
+#define DEVSPEC_HASH_SZ	1024
+
+struct devspec_entry {
+	struct devspec_entry *next;
+	char *sysfs_path;
+	char ofdt_path[];
+};
+
+struct devspec_map {
+	struct devspec_entry *hash[DEVSPEC_HASH_SZ];
+};
+
+static unsigned int devspec_hash(const char *path)
+{
+	unsigned int hash = 5381;
+
+	while (*path)
+		hash = hash * 33 + (unsigned char)*path++;
+
+	return hash & (DEVSPEC_HASH_SZ - 1);
+}
+
+static void free_devspec_map(struct devspec_map *map)
+{
+	struct devspec_entry *entry;
+	int i;
+
+	for (i = 0; i < DEVSPEC_HASH_SZ; i++) {
+		while (map->hash[i]) {
+			entry = map->hash[i];
+			map->hash[i] = entry->next;
+			free(entry);
+		}
+	}
+}
+
 /**
- * devspec_check_node
+ * build_devspec_map
+ * @brief Index the devices of a bus by the device tree path of their devspec
  *
- * @param node
- * @param sysfs_path
- * @param full_of_path
- * @param found
- * @returns 0 on success, !0 otherwise
+ * @param map map to fill in
+ * @param bus_dir sysfs devices directory of the bus
  */
-static int
-devspec_check_node(struct dr_node *node, char *sysfs_path,
-		   char *full_of_path, int *found)
+static void
+build_devspec_map(struct devspec_map *map, const char *bus_dir)
 {
-	struct dr_node *child;
+	struct devspec_entry *entry;
+	struct dirent *de;
+	DIR *d;
+	char sysfs_path[DR_PATH_MAX];
+	char devspec[DR_PATH_MAX];
+	unsigned int hash;
+	size_t len;
+
+	/* Not all the buses are present on every system */
+	d = opendir(bus_dir);
+	if (d == NULL)
+		return;
 
-	*found = 0;
+	while ((de = readdir(d)) != NULL) {
+		if (is_dot_dir(de->d_name))
+			continue;
 
-	if (!strlen(node->ofdt_path))
-		return 0;
+		snprintf(sysfs_path, DR_PATH_MAX, "%s/%s", bus_dir, de->d_name);
+		if (get_str_attribute(sysfs_path, "devspec", devspec,
+				      DR_PATH_MAX))
+			continue;
 
-	if (! strcmp(full_of_path, node->ofdt_path)) {
-		snprintf(node->sysfs_dev_path, DR_PATH_MAX, "%s", sysfs_path);
-		*found = 1;
-		return 0;
-	}
+		len = strlen(devspec) + 1;
+		entry = zalloc(sizeof(*entry) + len + strlen(sysfs_path) + 1);
+		if (entry == NULL)
+			break;
 
-	for (child = node->children; child; child = child->next) {
-		if (! strcmp(full_of_path, child->ofdt_path)) {
-			snprintf(child->sysfs_dev_path, DR_PATH_MAX, "%s",
-				 sysfs_path);
-			*found = 1;
-			return 0;
-		}
-	}
+		memcpy(entry->ofdt_path, devspec, len);
+		entry->sysfs_path = entry->ofdt_path + len;
+		strcpy(entry->sysfs_path, sysfs_path);
 
-	return 0;
+		hash = devspec_hash(devspec);
+		entry->next = map->hash[hash];
+		map->hash[hash] = entry;
+	}
+	closedir(d);
 }
 
 /**
  * correlate_devspec
+ * @brief Set the sysfs device path of a node from the devspec map
  *
- * @param sysfs_path
- * @param ofdt_path
+ * @param map devspec map
+ * @param node node to look up
  */
-static int
-correlate_devspec(char *sysfs_path, char *ofdt_path, struct dr_node *node_list)
+static void
+correlate_devspec(struct devspec_map *map, struct dr_node *node)
 {
-	struct dr_node *node;
-	char *full_of_path;
-	int found;
-	int rc;
+	struct devspec_entry *entry;
+	char *of_path = node->ofdt_path;
+	char *real_path;
 
-	full_of_path = of_to_full_path(ofdt_path);
-	for (node = node_list; node != NULL; node = node->next) {
-		rc = devspec_check_node(node, sysfs_path, full_of_path, &found);
-		if (rc)
-			return rc;
-		if (found)
+	if (!strlen(of_path))
+		return;
+
+	if (!strncmp(of_path, OFDT_BASE, strlen(OFDT_BASE)))
+		of_path += strlen(OFDT_BASE);
+
+	for (entry = map->hash[devspec_hash(of_path)]; entry;
+	     entry = entry->next) {
+		if (!strcmp(entry->ofdt_path, of_path))
 			break;
 	}
 
-	free(full_of_path);
-	return 0;
+	if (entry == NULL)
+		return;
+
+	/* Keep reporting the /sys/devices path, not the bus link */
+	real_path = realpath(entry->sysfs_path, NULL);
+	snprintf(node->sysfs_dev_path, DR_PATH_MAX, "%s",
+		 real_path ? real_path : entry->sysfs_path);
+	free(real_path);
 }
 
 /**
  * add_linux_devices
+ * @brief Find the sysfs devices of the nodes and their children
  *
+ * @param node_list list of nodes to update
  */
 static void
-add_linux_devices(char *start_dir, struct dr_node *node_list)
+add_linux_devices(struct dr_node *node_list)
 {
-	struct dirent *de;
-	DIR *d;
-	char *dir;
-	int rc;
+	struct devspec_map *map;
+	struct dr_node *node, *child;
+	int i;
 
-	if (start_dir == NULL)
-		dir = "/sys/devices";
-	else
-		dir = start_dir;
-
-	d = opendir(dir);
-	if (d == NULL) {
-		say(ERROR, "failed to open %s\n%s\n", dir, strerror(errno));
+	map = zalloc(sizeof(*map));
+	if (map == NULL)
 		return;
-	}
-
-	while ((de = readdir(d)) != NULL) {
-		char buf[1024];
 
-		if (is_dot_dir(de->d_name))
-			continue;
+	for (i = 0; i < sizeof(devspec_buses) / sizeof(devspec_buses[0]); i++)
+		build_devspec_map(map, devspec_buses[i]);
 
-		if (de->d_type == DT_DIR) {
-			sprintf(buf, "%s/%s", dir, de->d_name);
-			add_linux_devices(buf, node_list);
-		} else if (! strcmp(de->d_name, "devspec")) {
-			char devspec[DR_PATH_MAX];
-
-			sprintf(buf, "%s/%s", dir, de->d_name);
-			rc = get_str_attribute(buf, NULL, devspec, DR_PATH_MAX);
-			if (rc == 0)
-				rc = correlate_devspec(dir, devspec, node_list);
-		}
+	for (node = node_list; node != NULL; node = node->next) {
+		correlate_devspec(map, node);
+		for (child = node->children; child; child = child->next)
+			correlate_devspec(map, child);
 	}
-	closedir(d);
+
+	free_devspec_map(map);
+	free(map);
 }
 
 /**
@@ -875,7 +925,7 @@ get_dlpar_nodes(uint32_t node_types)
 	closedir(d);
 
 	if (node_list != NULL) {
-		add_linux_devices(NULL, node_list);
+		add_linux_devices(node_list);
 
 		if (node_types & PHB_NODES)
 			update_phb_ic_info(node_list);
@@ -939,7 +989,7 @@ get_hp_nodes()
 
 	_get_hp_nodes(OFDT_BASE, &node_list);
 	if (node_list != NULL)
-		add_linux_devices(NULL, node_list);
+		add_linux_devices(node_list);
 
 	return node_list;
 }
@@ -1293,6 +1343,8 @@ static int dlpar_io_kernel_op(const char *interface_file, const char *drc_name)
 	say(DEBUG, "performing kernel op for %s, file is %s\n", drc_name,
 	    interface_file);
 
+	ofdt_cache_invalidate();
+
 	do {
 		errno = 0;
 
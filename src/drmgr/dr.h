@@ -115,6 +115,7 @@ int get_int_attribute(const char *, const char *, void *, size_t);
 int get_str_attribute(const char *, const char *, void *, size_t);
 int get_ofdt_uint_property(const char *, const char *, uint *);
 int get_property_size(const char *, const char *);
+void ofdt_cache_invalidate(void);
 int signal_handler(int, int, struct sigcontext *);
 int sig_setup(void);
 char *node_type(struct dr_node *);
@@ -63,6 +63,8 @@ struct cache_info * cache_get_dependent_cache(struct cache_info *,
 					      struct dr_info *);
 int release_cpu(struct dr_node *, struct dr_info *);
 int probe_cpu(struct dr_node *, struct dr_info *);
+int release_cpus(struct dr_node **, int, struct dr_info *, int *);
+int probe_cpus(struct dr_node **, int, struct dr_info *, int *);
 struct dr_node *get_available_cpu(struct dr_info *);
 
 #endif /* _H_DRCPU */
@@ -19,11 +19,35 @@
  */
 #include "drpci.h"
 
+/* Per-LMB state bits kept in the lmb table */
+#define LMB_OWNED		0x01
+#define LMB_REMOVABLE		0x02
+#define LMB_MEM_NODE		0x04	/* represented by a memory@XXX node */
+#define LMB_SCNS_CHECKED	0x08	/* LMB_REMOVABLE is valid */
+
+/* Compact table of all possible LMBs for the system.  Each LMB occupies
+ * the same slot in every array, LMBs are looked up by drc index through
+ * an open addressed hash of slot numbers.
+ */
+struct lmb_table {
+	uint32_t	n_lmbs;
+	uint32_t	max_lmbs;
+	uint32_t	*drc_index;
+	uint64_t	*address;
+	uint64_t	*size;
+	uint32_t	*aa_index;
+	uint8_t		*state;
+	uint32_t	*hash;		/* slot + 1, 0 for an empty bucket */
+	uint32_t	hash_mask;
+};
+
 struct lmb_list_head {
-	struct dr_node	*lmbs;
-	struct dr_node	*last;
+	struct lmb_table lmbs;
+	uint32_t	*order;		/* table slots in the requested order */
+	struct dr_node	**nodes;	/* dr_nodes of the LMBs operated on */
 	char		*drconf_buf;
 	int		drconf_buf_sz;
+	int		drconf_v1;	/* slot n is drconf_buf entry n */
 	int		lmbs_modified;
 	int		sort;
 	int		lmbs_found;
@@ -62,3 +86,18 @@ extern uint64_t block_sz_bytes;
 
 struct lmb_list_head *get_lmbs(unsigned int);
 void free_lmbs(struct lmb_list_head *);
+int lmb_find(struct lmb_table *, uint32_t);
+void lmb_ofdt_path(struct lmb_list_head *, uint32_t, char *, size_t);
+int lmb_removable(struct lmb_list_head *, uint32_t);
+
+/* sysfs memory block number of the first section backing an LMB */
+static inline uint32_t lmb_first_scn(struct lmb_table *table, uint32_t slot)
+{
+	return table->address[slot] / block_sz_bytes;
+}
+
+/* number of sysfs memory blocks backing an LMB */
+static inline uint32_t lmb_nr_scns(struct lmb_table *table, uint32_t slot)
+{
+	return table->size[slot] / block_sz_bytes;
+}
@@ -200,6 +200,8 @@ do_update(char *cmd, int len)
 	int rc;
 	int i, fd;
 
+	ofdt_cache_invalidate();
+
 	fd = open(OFDTPATH, O_WRONLY);
 	if (fd == -1) {
 		say(ERROR, "Failed to open %s: %s\n", OFDTPATH,
@@ -217,46 +217,114 @@ struct dr_node *get_available_cpu(struct dr_info *dr_info)
 	return cpu;
 }
 
+/**
+ * select_cpus
+ * @brief Pick the cpus for the next round of an add or remove request
+ *
+ * Without a drc name or index, the cpus are taken in the order of
+ * get_next_available_cpu(): the last usable unowned cpus for an add,
+ * the first cpus with an online thread for a remove.
+ *
+ * @param dr_info cpu drc information
+ * @param cpus array filled with the cpus selected
+ * @param nr number of cpus wanted
+ * @returns the number of cpus selected
+ */
+static int select_cpus(struct dr_info *dr_info, struct dr_node **cpus, int nr)
+{
+	struct dr_node *cpu;
+	struct thread *t;
+	int avail = 0, n = 0;
+
+	if (usr_drc_name || usr_drc_index) {
+		cpus[0] = get_available_cpu(dr_info);
+		return cpus[0] ? 1 : 0;
+	}
+
+	if (usr_action == ADD) {
+		for (cpu = dr_info->all_cpus; cpu; cpu = cpu->next) {
+			if (!cpu->unusable && !cpu->is_owned)
+				avail++;
+		}
+
+		if (nr > avail)
+			nr = avail;
+
+		/* Fill the array backwards with the last nr cpus */
+		for (cpu = dr_info->all_cpus; cpu && avail; cpu = cpu->next) {
+			if (cpu->unusable || cpu->is_owned)
+				continue;
+
+			if (--avail < nr)
+				cpus[avail] = cpu;
+		}
+
+		n = nr;
+	} else if (usr_action == REMOVE) {
+		for (cpu = dr_info->all_cpus; cpu && n < nr; cpu = cpu->next) {
+			if (cpu->unusable || !cpu->is_owned)
+				continue;
+
+			for (t = cpu->cpu_threads; t; t = t->sibling) {
+				if (get_thread_state(t) == ONLINE) {
+					cpus[n++] = cpu;
+					break;
+				}
+			}
+		}
+	}
+
+	if (!n)
+		say(ERROR, "Could not find available cpu.\n");
+
+	return n;
+}
+
 /**
  * add_cpus
  *
  * Attempt to acquire and online the given number of cpus.
- * This function calls itself recursively to simplify recovery
- * actions in case of an error.  This is intended only for the case
- * where the user does not specify a drc-name.
+ * The cpus are selected and added as a set. If some of them cannot
+ * be acquired, another set is selected for the cpus still missing.
  *
  * The final steps are to display the drc-names value to stdout and
- * return with 0.
+ * return with 0. As with adding the cpus one at a time, the result is
+ * that of the last set attempted: cpus left out of it because drmgr
+ * timed out are not failures.
  *
- * @param nr_cpus
+ * @param dr_info cpu drc information
+ * @param count returns the number of cpus added
  * @returns 0 on success, !0 otherwise
  */
 static int add_cpus(struct dr_info *dr_info, int *count)
 {
+	struct dr_node **cpus;
+	int i, nr, added, tried;
 	int rc = -1;
-	struct dr_node *cpu = NULL;
+
+	cpus = zalloc(usr_drc_count * sizeof(*cpus));
+	if (!cpus)
+		return 1;
 
 	*count = 0;
 	while (*count < usr_drc_count) {
 		if (drmgr_timed_out())
 			break;
 
-		cpu = get_available_cpu(dr_info);
-		if (!cpu)
+		nr = select_cpus(dr_info, cpus, usr_drc_count - *count);
+		if (!nr)
 			break;
 
-		rc = probe_cpu(cpu, dr_info);
-		if (rc) {
-			say(DEBUG, "Unable to acquire CPU with drc index %x\n",
-			    cpu->drc_index);
-			cpu->unusable = 1;
-			continue;
-		}
+		added = probe_cpus(cpus, nr, dr_info, &tried);
+		for (i = 0; i < added; i++)
+			fprintf(stdout, "%s\n", cpus[i]->drc_name);
 
-		fprintf(stdout, "%s\n", cpu->drc_name);
-		(*count)++;
+		*count += added;
+		rc = (added < tried) ? -1 : 0;
 	}
 
+	free(cpus);
+
 	say(DEBUG, "Acquired %d of %d requested cpu(s).\n", *count,
 	    usr_drc_count);
 	return rc ? 1 : 0;
@@ -266,9 +334,11 @@ static int add_cpus(struct dr_info *dr_info, int *count)
  * remove_cpus
  *
  * Attempt to offline and release to the hypervisor the given number of
- * cpus.  This functions calls itself recursively to simplify recovery
- * actions in the case of an error.  This is intended only for the case
- * where the user does not specify a drc-name.
+ * cpus. The cpus are selected and released as a set. If some of them
+ * cannot be released, another set is selected for the cpus still to be
+ * removed. As with the cpus removed one at a time, the result is that of
+ * the last set attempted: cpus left out of it because drmgr timed out are
+ * not failures.
  *
  * From "Design Specification for AIX Configuration Support of
  * Dynamic Reconfiguration including the drmgr command and drslot for
@@ -282,44 +352,50 @@ static int add_cpus(struct dr_info *dr_info, int *count)
  * returns with 0, else displays an error message to stderr and returns with
  * non-zero."
  *
- * @param nr_cpus
+ * @param dr_info cpu drc information
+ * @param count returns the number of cpus removed
  * @returns 0 on success, !0 otherwise
  */
 static int remove_cpus(struct dr_info *dr_info, int *count)
 {
+	struct dr_node **cpus;
+	int i, nr, owned, removed, tried;
 	int rc = 0;
-	struct dr_node *cpu;
+
+	cpus = zalloc(usr_drc_count * sizeof(*cpus));
+	if (!cpus)
+		return -1;
 
 	*count = 0;
 	while (*count < usr_drc_count) {
 		if (drmgr_timed_out())
 			break;
 
-		if (cpu_count(dr_info) == 1) {
+		owned = cpu_count(dr_info);
+		if (owned == 1) {
 			say(WARN, "Cannot remove the last CPU\n");
 			rc = -1;
 			break;
 		}
 
-		cpu = get_available_cpu(dr_info);
-		if (!cpu)
+		nr = usr_drc_count - *count;
+		if (nr > owned - 1)
+			nr = owned - 1;
+
+		nr = select_cpus(dr_info, cpus, nr);
+		if (!nr)
 			break;
 
-		/* cpu is invalid after release_cpu, so no recovery
-		 * steps seem feasible.  We could copy the cpu name
-		 * and look it up again if the operation fails.
-		 */
-		rc = release_cpu(cpu, dr_info);
-		if (rc) {
-			online_cpu(cpu, dr_info);
-			cpu->unusable = 1;
-			continue;
-		}
+		removed = release_cpus(cpus, nr, dr_info, &tried);
+		for (i = 0; i < removed; i++)
+			fprintf(stdout, "%s\n", cpus[i]->drc_name);
 
-		fprintf(stdout, "%s\n", cpu->drc_name);
-		(*count)++;
+		*count += removed;
+		rc = (removed < tried) ? -1 : 0;
 	}
 
+	free(cpus);
+
 	say(DEBUG, "Removed %d of %d requested cpu(s)\n", *count,
 	    usr_drc_count);
 	return rc;
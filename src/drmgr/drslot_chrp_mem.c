@@ -32,6 +32,7 @@
 #include "ofdt.h"
 #include "drmem.h"
 #include "common_numa.h"
+#include "common_mem.h"
 
 uint64_t block_sz_bytes = 0;
 static char *state_strs[] = {"offline", "online"};
@@ -100,7 +101,23 @@ get_phandle(char *path, uint *phandle)
 void
 free_lmbs(struct lmb_list_head *lmb_list)
 {
-	free_node(lmb_list->lmbs);
+	struct lmb_table *table = &lmb_list->lmbs;
+	uint32_t i;
+
+	if (lmb_list->nodes) {
+		for (i = 0; i < table->n_lmbs; i++)
+			free_node(lmb_list->nodes[i]);
+
+		free(lmb_list->nodes);
+	}
+
+	free(table->drc_index);
+	free(table->address);
+	free(table->size);
+	free(table->aa_index);
+	free(table->state);
+	free(table->hash);
+	free(lmb_list->order);
 
 	if (lmb_list->drconf_buf)
 		free(lmb_list->drconf_buf);
@@ -108,6 +125,50 @@ free_lmbs(struct lmb_list_head *lmb_list)
 	free(lmb_list);
 }
 
+/**
+ * lmb_removable
+ * @brief Determine if the lmb in the specified slot is removable
+ *
+ * An lmb is removable if it is owned and all of the sysfs memory blocks
+ * backing it that are present are removable.  This is only evaluated the
+ * first time the lmb is looked at.
+ *
+ * @param lmb_list lmb list head
+ * @param slot slot of the lmb in the lmb table
+ * @returns 1 if the lmb is removable, 0 otherwise
+ */
+int lmb_removable(struct lmb_list_head *lmb_list, uint32_t slot)
+{
+	struct lmb_table *table = &lmb_list->lmbs;
+	uint32_t first, nr_scns, block;
+	int removable;
+
+	if (!(table->state[slot] & LMB_OWNED))
+		return 0;
+
+	if (table->state[slot] & LMB_SCNS_CHECKED)
+		return !!(table->state[slot] & LMB_REMOVABLE);
+
+	first = lmb_first_scn(table, slot);
+	nr_scns = lmb_nr_scns(table, slot);
+
+	removable = nr_scns > 0;
+	for (block = first; block < first + nr_scns; block++) {
+		struct mem_block *mb = mem_block_get(block, MEM_BLOCK_REMOVABLE);
+
+		if (mb && !mb->removable) {
+			removable = 0;
+			break;
+		}
+	}
+
+	table->state[slot] |= LMB_SCNS_CHECKED;
+	if (removable)
+		table->state[slot] |= LMB_REMOVABLE;
+
+	return removable;
+}
+
 /**
  * get_mem_scns
  * @brief Find the memory sections associated with the specified lmb
@@ -134,7 +195,7 @@ get_mem_scns(struct dr_node *lmb)
 	while (lmb_sz > 0) {
 		char *sysfs_path = "/sys/devices/system/memory/memory%d";
 		struct mem_scn *scn;
-		struct stat sbuf;
+		struct mem_block *mb;
 
 		scn = zalloc(sizeof(*scn));
 		if (scn == NULL)
@@ -143,10 +204,9 @@ get_mem_scns(struct dr_node *lmb)
 		sprintf(scn->sysfs_path, sysfs_path, mem_scn);
 		scn->phys_addr = phys_addr;
 
-		if (!stat(scn->sysfs_path, &sbuf)) {
-			get_int_attribute(scn->sysfs_path, "removable",
-					  &scn->removable,
-					  sizeof(scn->removable));
+		mb = mem_block_get(mem_scn, MEM_BLOCK_REMOVABLE);
+		if (mb) {
+			scn->removable = mb->removable;
 			if (!scn->removable)
 				lmb->is_removable = 0;
 		}
@@ -169,65 +229,212 @@ get_mem_scns(struct dr_node *lmb)
 }
 
 /**
- * get_lmb_size
- * @brief Retrieve the size of the lmb
+ * get_mem_node_size
+ * @brief Retrieve the size of a memory@XXX node from its reg property
  *
- * @param lmb lmb to get size for, or NULL for drconf lmb size
- * @param lmb_list list of lmbs, used to determine drconf usage
- * @returns size of lmb on succes, 0 on failure
+ * @param path device tree path of the memory node
+ * @param size pointer to the size to fill in
+ * @returns 0 on success, !0 on failure
  */
 static int
-get_lmb_size(struct dr_node *lmb)
+get_mem_node_size(const char *path, uint64_t *size)
 {
 	uint32_t regs[4];
 	int rc;
 
-	rc = get_property(lmb->ofdt_path, "reg", &regs, sizeof(regs));
+	rc = get_property(path, "reg", &regs, sizeof(regs));
 	if (rc) {
-		say(DEBUG, "Could not determine LMB size for %s\n",
-		    lmb->ofdt_path);
+		say(DEBUG, "Could not determine LMB size for %s\n", path);
 		return rc;
 	}
 
-	lmb->lmb_size = be32toh(regs[3]);
+	*size = be32toh(regs[3]);
+	return 0;
+}
+
+/**
+ * get_lmb_size
+ * @brief Retrieve the size of the lmb
+ *
+ * @param lmb lmb to get size for
+ * @returns 0 on success, !0 on failure
+ */
+static int
+get_lmb_size(struct dr_node *lmb)
+{
+	return get_mem_node_size(lmb->ofdt_path, &lmb->lmb_size);
+}
+
+static inline uint32_t lmb_hash(struct lmb_table *table, uint32_t drc_index)
+{
+	return (drc_index * 2654435761U) & table->hash_mask;
+}
+
+/**
+ * alloc_lmb_table
+ * @brief Allocate an lmb table large enough for the specified number of lmbs
+ *
+ * @param lmb_list lmb list head holding the table
+ * @param max_lmbs maximum number of lmbs the table will hold
+ * @returns 0 on success, !0 on failure
+ */
+static int
+alloc_lmb_table(struct lmb_list_head *lmb_list, uint32_t max_lmbs)
+{
+	struct lmb_table *table = &lmb_list->lmbs;
+	uint32_t hash_sz = 1;
+
+	/* keep the hash at most half full */
+	while (hash_sz < (max_lmbs * 2))
+		hash_sz <<= 1;
+
+	if (max_lmbs == 0)
+		max_lmbs = 1;
+
+	table->drc_index = zalloc(max_lmbs * sizeof(*table->drc_index));
+	table->address = zalloc(max_lmbs * sizeof(*table->address));
+	table->size = zalloc(max_lmbs * sizeof(*table->size));
+	table->aa_index = zalloc(max_lmbs * sizeof(*table->aa_index));
+	table->state = zalloc(max_lmbs * sizeof(*table->state));
+	table->hash = zalloc(hash_sz * sizeof(*table->hash));
+
+	if (!table->drc_index || !table->address || !table->size ||
+	    !table->aa_index || !table->state || !table->hash) {
+		say(DEBUG, "Could not allocate table for %u LMBs\n", max_lmbs);
+		return -1;
+	}
+
+	table->max_lmbs = max_lmbs;
+	table->hash_mask = hash_sz - 1;
 	return 0;
 }
 
 /**
- * lmb_list_add
- * @ brief add a dr_node to the specified lmb_list for the indicated drc_index
+ * lmb_find
+ * @brief Find the slot of an lmb in the lmb table
+ *
+ * @param table lmb table to search
+ * @param drc_index drc index of the lmb
+ * @returns slot of the lmb, -1 if not found
+ */
+int
+lmb_find(struct lmb_table *table, uint32_t drc_index)
+{
+	uint32_t bucket, slot;
+
+	if (table->hash == NULL)
+		return -1;
+
+	for (bucket = lmb_hash(table, drc_index); (slot = table->hash[bucket]);
+	     bucket = (bucket + 1) & table->hash_mask) {
+		if (table->drc_index[slot - 1] == drc_index)
+			return slot - 1;
+	}
+
+	return -1;
+}
+
+/**
+ * lmb_table_add
+ * @brief add an lmb to the lmb table
+ *
+ * @returns slot of the added lmb, -1 on failure
+ */
+static int
+lmb_table_add(struct lmb_list_head *lmb_list, uint32_t drc_index,
+	      uint64_t address, uint64_t lmb_sz, uint32_t aa_index,
+	      uint8_t state)
+{
+	struct lmb_table *table = &lmb_list->lmbs;
+	uint32_t bucket, slot;
+
+	if (table->n_lmbs >= table->max_lmbs)
+		return -1;
+
+	slot = table->n_lmbs++;
+	table->drc_index[slot] = drc_index;
+	table->address[slot] = address;
+	table->size[slot] = lmb_sz;
+	table->aa_index[slot] = aa_index;
+	table->state[slot] = state;
+
+	for (bucket = lmb_hash(table, drc_index); table->hash[bucket];
+	     bucket = (bucket + 1) & table->hash_mask)
+		;
+	table->hash[bucket] = slot + 1;
+
+	return slot;
+}
+
+/**
+ * lmb_ofdt_path
+ * @brief Build the device tree path of the lmb in the specified slot
  *
- * @param drc_index drc index of the LMB to add
- * @param lmb_list lmb list head to add the lmb to
- * @return pointer to allocated lmb node on success, NULL on failure
+ * @param lmb_list lmb list head
+ * @param slot slot of the lmb in the lmb table
+ * @param buf buffer to hold the path
+ * @param buf_sz size of the buffer
  */
-static struct dr_node *lmb_list_add(uint32_t drc_index,
-				    struct lmb_list_head *lmb_list)
+void
+lmb_ofdt_path(struct lmb_list_head *lmb_list, uint32_t slot, char *buf,
+	      size_t buf_sz)
 {
+	struct lmb_table *table = &lmb_list->lmbs;
+
+	if (table->state[slot] & LMB_MEM_NODE)
+		snprintf(buf, buf_sz, "%s/memory@%"PRIx64, OFDT_BASE,
+			 table->address[slot]);
+	else if (lmb_list->drconf_buf)
+		snprintf(buf, buf_sz, "%s", DYNAMIC_RECONFIG_MEM);
+	else
+		buf[0] = '\0';
+}
+
+/**
+ * get_lmb_node
+ * @brief Get the dr_node for the lmb in the specified slot
+ *
+ * LMBs only get a full dr_node once they are selected for an operation,
+ * everything else is kept in the lmb table.
+ *
+ * @param lmb_list lmb list head
+ * @param slot slot of the lmb in the lmb table
+ * @returns pointer to the lmb's dr_node, NULL on failure
+ */
+static struct dr_node *
+get_lmb_node(struct lmb_list_head *lmb_list, uint32_t slot)
+{
+	struct lmb_table *table = &lmb_list->lmbs;
 	struct dr_node *lmb;
 
+	if (lmb_list->nodes[slot])
+		return lmb_list->nodes[slot];
+
 	lmb = zalloc(sizeof(*lmb));
 	if (lmb == NULL)
 		return NULL;
 
-	lmb->drc_index = drc_index;
+	lmb->drc_index = table->drc_index[slot];
 	lmb->dev_type = MEM_DEV;
+	lmb->lmb_address = table->address[slot];
+	lmb->lmb_size = table->size[slot];
+	lmb->lmb_aa_index = table->aa_index[slot];
+	lmb_ofdt_path(lmb_list, slot, lmb->ofdt_path, DR_PATH_MAX);
 
-	if (lmb_list->sort == LMB_REVERSE_SORT) {
-		if (lmb_list->last)
-			lmb->next = lmb_list->last;
-		lmb_list->lmbs = lmb;
-	} else {
-		if (lmb_list->last)
-			lmb_list->last->next = lmb;
-		else
-			lmb_list->lmbs = lmb;
+	if (table->state[slot] & LMB_OWNED) {
+		lmb->is_owned = 1;
+
+		/* find the associated sysfs memory blocks */
+		if (get_mem_scns(lmb)) {
+			free_node(lmb);
+			return NULL;
+		}
 	}
 
-	lmb_list->last = lmb;
+	lmb_list->nodes[slot] = lmb;
 	return lmb;
 }
- 
+
 /**
  * get_mem_node_lmbs
  * @brief Retrieve lmbs from the OF device tree represented as memory@XXX nodes
@@ -238,7 +445,7 @@ static struct dr_node *lmb_list_add(uint32_t drc_index,
 int
 get_mem_node_lmbs(struct lmb_list_head *lmb_list)
 {
-	struct dr_node *lmb;
+	struct lmb_table *table = &lmb_list->lmbs;
 	struct dirent *de;
 	DIR *d;
 	int rc = 0;
@@ -254,6 +461,7 @@ get_mem_node_lmbs(struct lmb_list_head *lmb_list)
 		char path[1024];
 		uint32_t my_drc_index;
 		char *tmp;
+		int slot;
 
 		if (de->d_type != DT_DIR)
 			continue;
@@ -267,55 +475,48 @@ get_mem_node_lmbs(struct lmb_list_head *lmb_list)
 		if (get_my_drc_index(path, &my_drc_index))
 			continue;
 
-		for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
-			if (lmb->drc_index == my_drc_index)
-				break;
-		}
-
-		if (lmb == NULL) {
+		slot = lmb_find(table, my_drc_index);
+		if (slot < 0) {
 			say(DEBUG, "Could not find LMB with drc-index of %x\n",
 			    my_drc_index);
 			rc = -1;
 			break;
 		}
 
-		snprintf(lmb->ofdt_path, DR_PATH_MAX, "%s", path);
-		lmb->is_owned = 1;
+		table->state[slot] |= LMB_OWNED | LMB_MEM_NODE;
 
 		/* Find the lmb size for this lmb */
 		/* XXX Do nothing with size and break if it can't be found
 		 * but don't change rc to indicate failure?
 		 * Why not continue? If we break, set rc=-1? */
-		if (get_lmb_size(lmb))
+		if (get_mem_node_size(path, &table->size[slot]))
 			break;
 
 		/* Find the physical address for this lmb */
-		tmp = strrchr(lmb->ofdt_path, '@');
+		tmp = strrchr(path, '@');
 		if (tmp == NULL) {
 			say(DEBUG, "Could not determine physical address for "
-			    "%s\n", lmb->ofdt_path);
+			    "%s\n", path);
 			/* XXX No rc change? */
 			break;
 		}
 
-		lmb->lmb_address = strtoull(tmp + 1, NULL, 16);
+		table->address[slot] = strtoull(tmp + 1, NULL, 16);
 
-		/* find the associated sysfs memory blocks */
-		rc = get_mem_scns(lmb);
-		if (rc)
-			break;
+		/* removability depends on the address and size found here */
+		table->state[slot] &= ~(LMB_SCNS_CHECKED | LMB_REMOVABLE);
 	}
 
 	closedir(d);
 	return rc;
 }
 
-static int link_lmb_to_numa_node(struct dr_node *lmb)
+static int link_lmb_to_numa_node(uint32_t drc_index, uint32_t aa_index)
 {
 	int nid;
 	struct ppcnuma_node *node;
 
-	nid = aa_index_to_node(&numa.aa, lmb->lmb_aa_index);
+	nid = aa_index_to_node(&numa.aa, aa_index);
 	if (nid == -1)
 		return 0;
 
@@ -323,9 +524,19 @@ static int link_lmb_to_numa_node(struct dr_node *lmb)
 	if (!node)
 		return -ENOMEM;
 
-	lmb->lmb_numa_next = node->lmbs;
-	node->lmbs = lmb;
-	node->n_lmbs++;
+	if (node->n_lmbs == node->lmbs_sz) {
+		unsigned int new_sz = node->lmbs_sz ? node->lmbs_sz * 2 : 64;
+		uint32_t *lmbs;
+
+		lmbs = realloc(node->lmbs, new_sz * sizeof(*lmbs));
+		if (!lmbs)
+			return -ENOMEM;
+
+		node->lmbs = lmbs;
+		node->lmbs_sz = new_sz;
+	}
+
+	node->lmbs[node->n_lmbs++] = drc_index;
 
 	if (node->n_cpus)
 		numa.lmb_count++;
@@ -339,37 +550,58 @@ int add_lmb(struct lmb_list_head *lmb_list, uint32_t drc_index,
 	    uint64_t address, uint64_t lmb_sz, uint32_t aa_index,
 	    uint32_t flags)
 {
-	struct dr_node *lmb;
+	uint8_t state = 0;
+
+	/* The associated sysfs memory blocks are only checked once the lmb
+	 * is looked at, see lmb_removable().
+	 */
+	if (flags & DRMEM_ASSIGNED)
+		state |= LMB_OWNED;
 
-	lmb = lmb_list_add(drc_index, lmb_list);
-	if (lmb == NULL) {
-		say(DEBUG, "Could not find LMB with drc-index of %x\n",
+	if (lmb_table_add(lmb_list, drc_index, address, lmb_sz, aa_index,
+			  state) < 0) {
+		say(DEBUG, "Could not add LMB with drc-index of %x\n",
 		    drc_index);
 		return -1;
 	}
 
-	sprintf(lmb->ofdt_path, DYNAMIC_RECONFIG_MEM);
-	lmb->lmb_size = lmb_sz;
-	lmb->lmb_address = address;
-	lmb->lmb_aa_index = aa_index;
-
-	if (numa_enabled && link_lmb_to_numa_node(lmb))
+	/* Only LMBs owned by the partition are candidates for a NUMA based
+	 * removal, linking the others would skew the node ratios and break
+	 * the contiguous runs used by remove_lmb_from_node().
+	 */
+	if (numa_enabled && (state & LMB_OWNED) &&
+	    link_lmb_to_numa_node(drc_index, aa_index))
 		return -ENOMEM;
 
-	if (flags & DRMEM_ASSIGNED) {
-		int rc;
+	lmb_list->lmbs_found++;
+	return 0;
+}
 
-		lmb->is_owned = 1;
+/**
+ * find_drconf_mem
+ * @brief Find the ibm,dynamic-memory entry for the specified drc index
+ *
+ * @param lmb_list lmb list head holding the ibm,dynamic-memory buffer
+ * @param drc_index drc index to look up
+ * @returns pointer into the drconf buffer, NULL if not found
+ */
+static struct drconf_mem *find_drconf_mem(struct lmb_list_head *lmb_list,
+					  uint32_t drc_index)
+{
+	struct drconf_mem *drmem;
+	int slot;
 
-		/* find the associated sysfs memory blocks */
-		rc = get_mem_scns(lmb);
-		if (rc)
-			return -1;
-	}
+	if (!lmb_list->drconf_v1)
+		return NULL;
 
-	lmb_list->lmbs_found++;
-	return 0;
+	slot = lmb_find(&lmb_list->lmbs, drc_index);
+	if (slot < 0)
+		return NULL;
+
+	drmem = (struct drconf_mem *)(lmb_list->drconf_buf + sizeof(uint32_t));
+	return &drmem[slot];
 }
+
 /**
  * get_dynamic_reconfig_lmbs_v1
  * @brief Retrieve lmbs from OF device tree located in the ibm,dynamic-memory
@@ -409,6 +641,9 @@ get_dynamic_reconfig_lmbs_v1(uint64_t lmb_sz, struct lmb_list_head *lmb_list)
 	/* convert for LE systems */
 	num_entries = be32toh(num_entries);
 
+	if (alloc_lmb_table(lmb_list, num_entries))
+		return -1;
+
 	/* Followed by the actual entries */
 	drmem = (struct drconf_mem *)
 				(lmb_list->drconf_buf + sizeof(num_entries));
@@ -423,6 +658,12 @@ get_dynamic_reconfig_lmbs_v1(uint64_t lmb_sz, struct lmb_list_head *lmb_list)
 		drmem++; /* trust your compiler */
 	}
 
+	/* Every entry has been added in order, the lmb table slot of an
+	 * lmb is also its entry in the drconf buffer.
+	 */
+	if (!rc)
+		lmb_list->drconf_v1 = 1;
+
 	return rc;
 }
 
@@ -438,7 +679,7 @@ int get_dynamic_reconfig_lmbs_v2(uint64_t lmb_sz,
 				 struct lmb_list_head *lmb_list)
 {
 	struct drconf_mem_v2 *drmem;
-	uint32_t lmb_sets;
+	uint32_t lmb_sets, total_lmbs = 0;
 	int i, rc = 0;
 
 	lmb_list->drconf_buf_sz = get_property_size(DYNAMIC_RECONFIG_MEM,
@@ -466,6 +707,13 @@ int get_dynamic_reconfig_lmbs_v2(uint64_t lmb_sz,
 	drmem = (struct drconf_mem_v2 *)
 				(lmb_list->drconf_buf + sizeof(lmb_sets));
 
+	/* Size the lmb table from the number of lmbs in all of the sets */
+	for (i = 0; i < lmb_sets; i++)
+		total_lmbs += be32toh(drmem[i].seq_lmbs);
+
+	if (alloc_lmb_table(lmb_list, total_lmbs))
+		return -1;
+
 	for (i = 0; i < lmb_sets; i++) {
 		uint32_t drc_index, seq_lmbs;
 		uint64_t address;
@@ -536,39 +784,54 @@ get_dynamic_reconfig_lmbs(struct lmb_list_head *lmb_list)
 
 /**
  * shuffle_lmbs
- * @brief Randomly shuffle list of lmbs
+ * @brief Randomly shuffle the order of the lmbs
  *
- * @param list pointer to lmb list to be randomly shuffled
- * @param length number of lmbs in the list
+ * @param lmb_list pointer to lmb list whose order is to be shuffled
  */
 static void shuffle_lmbs(struct lmb_list_head *lmb_list)
 {
-	struct dr_node **shuffled_lmbs, *lmb;
-	int total_lmbs = lmb_list->lmbs_found;
-	int i, j;
-	
-	srand(time(NULL));
+	uint32_t *order = lmb_list->order;
+	uint32_t i, j, tmp;
 
-	shuffled_lmbs = zalloc(sizeof(*shuffled_lmbs) * total_lmbs);
+	srand(time(NULL));
 
-	for (i = 0, lmb = lmb_list->lmbs; lmb; i++, lmb = lmb->next) {
-		j = rand() % (i + 1);
+	for (i = lmb_list->lmbs.n_lmbs; i > 1; i--) {
+		j = rand() % i;
 
-		if (j == i) {
-			shuffled_lmbs[i] = lmb;
-		} else {
-			shuffled_lmbs[i] = shuffled_lmbs[j];
-			shuffled_lmbs[j] = lmb;
-		}
+		tmp = order[i - 1];
+		order[i - 1] = order[j];
+		order[j] = tmp;
 	}
+}
 
-	for (i = 0; i < (total_lmbs - 1); i++)
-		shuffled_lmbs[i]->next = shuffled_lmbs[i + 1];
+/**
+ * sort_lmbs
+ * @brief Initialize the order in which the lmbs are walked
+ *
+ * @param lmb_list pointer to lmb list head
+ * @returns 0 on success, !0 on failure
+ */
+static int sort_lmbs(struct lmb_list_head *lmb_list)
+{
+	uint32_t n_lmbs = lmb_list->lmbs.n_lmbs;
+	uint32_t i;
 
-	shuffled_lmbs[total_lmbs - 1]->next = NULL;
+	lmb_list->order = zalloc(MAX(n_lmbs, 1) * sizeof(*lmb_list->order));
+	lmb_list->nodes = zalloc(MAX(n_lmbs, 1) * sizeof(*lmb_list->nodes));
+	if (lmb_list->order == NULL || lmb_list->nodes == NULL)
+		return -1;
 
-	lmb_list->lmbs = shuffled_lmbs[0];
-	free(shuffled_lmbs);
+	for (i = 0; i < n_lmbs; i++) {
+		if (lmb_list->sort == LMB_REVERSE_SORT)
+			lmb_list->order[i] = n_lmbs - i - 1;
+		else
+			lmb_list->order[i] = i;
+	}
+
+	if (lmb_list->sort == LMB_RANDOM_SORT)
+		shuffle_lmbs(lmb_list);
+
+	return 0;
 }
 
 /**
@@ -583,7 +846,6 @@ struct lmb_list_head *
 get_lmbs(unsigned int sort)
 {
 	struct lmb_list_head *lmb_list = NULL;
-	struct dr_node *lmb = NULL;
 	struct stat sbuf;
 	char buf[DR_STR_MAX];
 	int rc = 0;
@@ -607,6 +869,12 @@ get_lmbs(unsigned int sort)
 
 	block_sz_bytes = strtoul(buf, NULL, 16);
 
+	if (mem_blocks_init()) {
+		say(DEBUG, "Could not find the sysfs memory blocks.\n");
+		free_lmbs(lmb_list);
+		return NULL;
+	}
+
 	/* We also need to know which lmbs are already allocated to
 	 * the system and their corresponding memory sections as defined
 	 * by sysfs.  Walk the device tree and update the appropriate
@@ -615,34 +883,42 @@ get_lmbs(unsigned int sort)
 	 */
 	if (stat(DYNAMIC_RECONFIG_MEM, &sbuf)) {
 		struct dr_connector *drc_list, *drc;
+		uint32_t max_lmbs = 0;
 
 		drc_list = get_drc_info(OFDT_BASE);
 		if (drc_list == NULL) {
 			report_unknown_error(__FILE__, __LINE__);
 			rc = -1;
 		} else {
-			/* For memory dlpar, we need a list of all
-			 * posiible memory nodes for the system, initalize
-			 * those here.
-			 */
 			for (drc = drc_list; drc; drc = drc->next) {
-				if (strncmp(drc->name, "LMB", 3))
-					continue;
-
-				lmb = lmb_list_add(drc->index, lmb_list);
-				if (!lmb) {
-					say(ERROR, "Failed to add LMB (%x)\n",
-					    drc->index);
-					rc = -1;
-					break;
-				}
-
-				lmb_list->lmbs_found++;
+				if (!strncmp(drc->name, "LMB", 3))
+					max_lmbs++;
+			}
+
+			rc = alloc_lmb_table(lmb_list, max_lmbs);
+		}
+
+		/* For memory dlpar, we need a list of all
+		 * posiible memory nodes for the system, initalize
+		 * those here.
+		 */
+		for (drc = drc_list; drc && !rc; drc = drc->next) {
+			if (strncmp(drc->name, "LMB", 3))
+				continue;
+
+			if (lmb_table_add(lmb_list, drc->index, 0, 0, 0, 0) < 0) {
+				say(ERROR, "Failed to add LMB (%x)\n",
+				    drc->index);
+				rc = -1;
+				break;
 			}
+
+			lmb_list->lmbs_found++;
 		}
 
 		say(INFO, "Maximum of %d LMBs\n", lmb_list->lmbs_found);
-		rc = get_mem_node_lmbs(lmb_list);
+		if (!rc)
+			rc = get_mem_node_lmbs(lmb_list);
 	} else {
 		/* A small hack to here to allow memory add to work in
 		 * certain kernels.  Due to a bug in the kernel (see comment
@@ -655,11 +931,12 @@ get_lmbs(unsigned int sort)
 			rc = get_mem_node_lmbs(lmb_list);
 	}
 
+	if (!rc)
+		rc = sort_lmbs(lmb_list);
+
 	if (rc) {
 		free_lmbs(lmb_list);
 		lmb_list = NULL;
-	} else if (sort == LMB_RANDOM_SORT) {
-		shuffle_lmbs(lmb_list);
 	}
 
 	return lmb_list;
@@ -672,53 +949,54 @@ get_lmbs(unsigned int sort)
  * already owned by the partition and is available, or the lmb
  * matching the one specified by the user.
  *
- * @param start_lmb first lmbs to be searched for an available lmb
+ * @param lmb_list list of lmbs on the partition
+ * @param pos position in the lmb order to start searching from, updated
+ *	      to the position following the lmb found
  * @returns pointer to avaiable lmb on success, NULL otherwise
  */
-static struct dr_node *get_available_lmb(struct dr_node *start_lmb)
+static struct dr_node *get_available_lmb(struct lmb_list_head *lmb_list,
+					 uint32_t *pos)
 {
+	struct lmb_table *table = &lmb_list->lmbs;
 	uint32_t drc_index;
-	struct dr_node *lmb;
 	struct dr_node *usable_lmb = NULL;
 	int balloon_active = ams_balloon_active();
 
-	for (lmb = start_lmb; lmb; lmb = lmb->next) {
+	for (; *pos < table->n_lmbs; (*pos)++) {
+		uint32_t slot = lmb_list->order[*pos];
+		uint8_t state = table->state[slot];
 		int rc;
 
 		if (usr_drc_name) {
 			drc_index = strtoul(usr_drc_name, NULL, 0);
 
-			if ((strcmp(lmb->drc_name, usr_drc_name))
-			    && (lmb->drc_index != drc_index))
+			if (table->drc_index[slot] != drc_index)
 				continue;
 		} else if (usr_drc_index) {
-			if (lmb->drc_index != usr_drc_index)
+			if (table->drc_index[slot] != usr_drc_index)
 				continue;
 		}
 
-		if (lmb->unusable)
+		if (lmb_list->nodes[slot] && lmb_list->nodes[slot]->unusable)
 			continue;
 
 		if (usr_action == ADD) {
-			if (lmb->is_owned)
+			if (state & LMB_OWNED)
 				continue;
 
-			rc = dr_entity_sense(lmb->drc_index);
+			rc = dr_entity_sense(table->drc_index[slot]);
 			if (rc != STATE_UNUSABLE)
 				continue;
-
-			usable_lmb = lmb;
 		} else if (usr_action == REMOVE) {
 			/* removable is ignored if AMS ballooning is active. */
-			if ((!balloon_active && !lmb->is_removable) ||
-			    (!lmb->is_owned))
+			if (!(state & LMB_OWNED) ||
+			    (!balloon_active && !lmb_removable(lmb_list, slot)))
 				continue;
-
-			usable_lmb = lmb;
-			break;
 		}
 
 		/* Found an available lmb */
+		usable_lmb = get_lmb_node(lmb_list, slot);
+		(*pos)++;
 		break;
 	}
 
@@ -780,51 +1058,24 @@ static void update_drconf_affinity(struct dr_node *lmb,
 }
 	
 /**
- * update_drconf_node
- * @brief update the ibm,dynamic-memory property for added/removed memory
+ * commit_drconf_node
+ * @brief push the current drconf buffer to the kernel
  *
- * @param lmb pointer to updated lmb
+ * @param lmb lmb used to identify the node and the address for the update
  * @param lmb_list pointer to all lmbs
  * @param action ADD or REMOVE
  * @returns 0 on success, !0 on failure
  */
 static int
-update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
+commit_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
 		   int action)
 {
 	char *prop_buf;
 	size_t prop_buf_sz;
 	char *tmp;
-	struct drconf_mem *drmem;
 	uint phandle;
-	int i, entries;
 	int rc;
 
-	/* The first int of the buffer is the number of entries */
-	entries = *(int *)lmb_list->drconf_buf;
-
-	/* convert for LE systems */
-	entries = be32toh(entries);
-
-	drmem = (struct drconf_mem *)(lmb_list->drconf_buf + sizeof(entries));
-
-	for (i = 0; i < entries; i++) {
-
-		if (be32toh(drmem->drc_index) != lmb->drc_index) {
-			drmem++;
-			continue;
-		}
-
-		if (action == ADD) {
-			drmem->flags |= be32toh(DRMEM_ASSIGNED);
-			update_drconf_affinity(lmb, drmem);
-		} else {
-			drmem->flags &= be32toh(~DRMEM_ASSIGNED);
-		}
-
-		break;
-	}
-
 	/* Now create the buffer we pass to the kernel to have this
 	 * property updated.  This buffer has the format
 	 * "update_property <phandle> ibm,dynamic-memory <prop_len> <prop> \
@@ -845,6 +1096,7 @@ update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
 	if (rc) {
 		say(DEBUG, "Failed to get phandle for %s under %s. (rc=%d)\n", 
 				lmb->drc_name, lmb->ofdt_path, rc);
+		free(prop_buf);
 		return rc;
 	}
 
@@ -868,6 +1120,50 @@ update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
 	return rc;
 }
 
+/**
+ * set_drconf_flags
+ * @brief mark an lmb assigned or unassigned in the drconf buffer
+ *
+ * @param lmb pointer to updated lmb
+ * @param lmb_list pointer to all lmbs
+ * @param action ADD or REMOVE
+ */
+static void
+set_drconf_flags(struct dr_node *lmb, struct lmb_list_head *lmb_list,
+		 int action)
+{
+	struct drconf_mem *drmem;
+
+	drmem = find_drconf_mem(lmb_list, lmb->drc_index);
+	if (drmem == NULL)
+		return;
+
+	if (action == ADD) {
+		drmem->flags |= be32toh(DRMEM_ASSIGNED);
+		if (lmb->lmb_of_node)
+			update_drconf_affinity(lmb, drmem);
+	} else {
+		drmem->flags &= be32toh(~DRMEM_ASSIGNED);
+	}
+}
+
+/**
+ * update_drconf_node
+ * @brief update the ibm,dynamic-memory property for added/removed memory
+ *
+ * @param lmb pointer to updated lmb
+ * @param lmb_list pointer to all lmbs
+ * @param action ADD or REMOVE
+ * @returns 0 on success, !0 on failure
+ */
+static int
+update_drconf_node(struct dr_node *lmb, struct lmb_list_head *lmb_list,
+		   int action)
+{
+	set_drconf_flags(lmb, lmb_list, action);
+	return commit_drconf_node(lmb, lmb_list, action);
+}
+
 /**
  * remove_device_tree_lmb
  * @brief Update the device tree for the lmb being removed.
@@ -886,24 +1182,18 @@ remove_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
 }
 
 /**
- * add_device_tree_lmb
- * @brief Update the device tree for the lmb being added..
+ * __add_device_tree_lmb
+ * @brief Update the device tree for an lmb whose connector is configured
  *
- * @param lmb lmb to acquire
+ * @param lmb lmb to acquire, lmb_of_node must already be set
  * @param lmb_list list of all lmbs
  * @returns 0 on success, !0 otherwise
  */
 static int
-add_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
+__add_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
 {
         int rc;
 
-	lmb->lmb_of_node = configure_connector(lmb->drc_index);
-	if (lmb->lmb_of_node == NULL) {
-		release_drc(lmb->drc_index, MEM_DEV);
-		return -1;
-	}
-	
 	if (lmb_list->drconf_buf) {
 		errno = 0;
 		rc = update_drconf_node(lmb, lmb_list, ADD);
@@ -963,6 +1253,26 @@ add_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
         return rc;
 }
 
+/**
+ * add_device_tree_lmb
+ * @brief Update the device tree for the lmb being added..
+ *
+ * @param lmb lmb to acquire
+ * @param lmb_list list of all lmbs
+ * @returns 0 on success, !0 otherwise
+ */
+static int
+add_device_tree_lmb(struct dr_node *lmb, struct lmb_list_head *lmb_list)
+{
+	lmb->lmb_of_node = configure_connector(lmb->drc_index);
+	if (lmb->lmb_of_node == NULL) {
+		release_drc(lmb->drc_index, MEM_DEV);
+		return -1;
+	}
+
+	return __add_device_tree_lmb(lmb, lmb_list);
+}
+
 /**
  * get_mem_scn_state
  * @brief Find the state of the specified memory section
@@ -1160,6 +1470,96 @@ set_lmb_state(struct dr_node *lmb, int state)
 	return rc;
 }
 
+/**
+ * add_lmbs_batched
+ *
+ * Acquire and online the requested number of LMBs in batches.  The
+ * connectors for the whole batch are acquired and configured first,
+ * then each LMB is added to the ibm,dynamic-memory property and onlined.
+ * The kernel only acts on the LMB named in a property update, so the
+ * property is still updated once per LMB.
+ *
+ * @param lmb_list list of lmbs on the partition
+ * @returns 0 on success, !0 otherwise
+ */
+static int add_lmbs_batched(struct lmb_list_head *lmb_list)
+{
+	uint32_t pos = 0;
+	struct dr_node **batch;
+	struct dr_node *lmb;
+	int i, nr_lmbs;
+	int rc = 0;
+
+	batch = zalloc(usr_drc_count * sizeof(*batch));
+	if (batch == NULL)
+		return -1;
+
+	lmb_list->lmbs_modified = 0;
+	while (lmb_list->lmbs_modified < usr_drc_count) {
+		nr_lmbs = 0;
+		while (lmb_list->lmbs_modified + nr_lmbs < usr_drc_count) {
+			if (drmgr_timed_out())
+				break;
+
+			lmb = get_available_lmb(lmb_list, &pos);
+			if (lmb == NULL)
+				break;
+
+			rc = acquire_drc(lmb->drc_index);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			lmb->lmb_of_node = configure_connector(lmb->drc_index);
+			if (lmb->lmb_of_node == NULL) {
+				report_unknown_error(__FILE__, __LINE__);
+				release_drc(lmb->drc_index, MEM_DEV);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			batch[nr_lmbs++] = lmb;
+		}
+
+		if (nr_lmbs == 0) {
+			if (!drmgr_timed_out())
+				rc = -1;
+			break;
+		}
+
+		for (i = 0; i < nr_lmbs; i++) {
+			lmb = batch[i];
+
+			rc = __add_device_tree_lmb(lmb, lmb_list);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				release_drc(lmb->drc_index, MEM_DEV);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			rc = set_lmb_state(lmb, ONLINE);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				remove_device_tree_lmb(lmb, lmb_list);
+				release_drc(lmb->drc_index, MEM_DEV);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			lmb_list->lmbs_modified++;
+		}
+
+		if (drmgr_timed_out())
+			break;
+	}
+
+	free(batch);
+	return rc;
+}
+
 /**
  * add_lmbs
  *
@@ -1175,21 +1575,21 @@ set_lmb_state(struct dr_node *lmb, int state)
 static int add_lmbs(struct lmb_list_head *lmb_list)
 {
 	int rc = 0;
-	struct dr_node *lmb_head = lmb_list->lmbs;
+	uint32_t pos = 0;
 	struct dr_node *lmb;
 
+	if (lmb_list->drconf_v1)
+		return add_lmbs_batched(lmb_list);
+
 	lmb_list->lmbs_modified = 0;
 	while (lmb_list->lmbs_modified < usr_drc_count) {
 		if (drmgr_timed_out())
 			break;
 
-		lmb = get_available_lmb(lmb_head);
+		lmb = get_available_lmb(lmb_list, &pos);
 		if (lmb == NULL)
 			return -1;
 
-		/* Iterate only over the remaining LMBs */
-		lmb_head = lmb->next;
-
 		rc = acquire_drc(lmb->drc_index);
 		if (rc) {
 			report_unknown_error(__FILE__, __LINE__);
@@ -1249,6 +1649,91 @@ static int mem_add(void)
 	return rc;
 }
 
+/**
+ * remove_lmbs_batched
+ *
+ * Offline and release the requested number of LMBs in batches.  The
+ * whole batch is offlined first, then each LMB is removed from the
+ * ibm,dynamic-memory property, which the kernel only acts on for the
+ * LMB it names, and released.
+ *
+ * @param lmb_list list of lmbs on the partition
+ * @return 0 on success, !0 otherwise
+ */
+static int remove_lmbs_batched(struct lmb_list_head *lmb_list)
+{
+	uint32_t pos = 0;
+	struct dr_node **batch;
+	struct dr_node *lmb;
+	int i, nr_lmbs;
+	int rc;
+
+	batch = zalloc(usr_drc_count * sizeof(*batch));
+	if (batch == NULL)
+		return -1;
+
+	while (lmb_list->lmbs_modified < usr_drc_count) {
+		nr_lmbs = 0;
+		while (lmb_list->lmbs_modified + nr_lmbs < usr_drc_count) {
+			if (drmgr_timed_out())
+				break;
+
+			lmb = get_available_lmb(lmb_list, &pos);
+			if (!lmb)
+				break;
+
+			rc = set_lmb_state(lmb, OFFLINE);
+			if (rc) {
+				lmb->unusable = 1;
+				continue;
+			}
+
+			batch[nr_lmbs++] = lmb;
+		}
+
+		if (nr_lmbs == 0) {
+			free(batch);
+			return drmgr_timed_out() ? 0 : -1;
+		}
+
+		for (i = 0; i < nr_lmbs; i++) {
+			lmb = batch[i];
+
+			rc = remove_device_tree_lmb(lmb, lmb_list);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				set_lmb_state(lmb, ONLINE);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			while (lmb->lmb_mem_scns) {
+				struct mem_scn *scn = lmb->lmb_mem_scns;
+				lmb->lmb_mem_scns = scn->next;
+				free(scn);
+			}
+
+			rc = release_drc(lmb->drc_index, 0);
+			if (rc) {
+				report_unknown_error(__FILE__, __LINE__);
+				add_device_tree_lmb(lmb, lmb_list);
+				set_lmb_state(lmb, ONLINE);
+				lmb->unusable = 1;
+				continue;
+			}
+
+			lmb->is_removable = 0;
+			lmb_list->lmbs_modified++;
+		}
+
+		if (drmgr_timed_out())
+			break;
+	}
+
+	free(batch);
+	return 0;
+}
+
 /**
  * remove_lmbs
  *
@@ -1258,21 +1743,21 @@ static int mem_add(void)
  */
 static int remove_lmbs(struct lmb_list_head *lmb_list)
 {
-	struct dr_node *lmb_head = lmb_list->lmbs;
+	uint32_t pos = 0;
 	struct dr_node *lmb;
 	int rc;
 
+	if (lmb_list->drconf_v1)
+		return remove_lmbs_batched(lmb_list);
+
 	while (lmb_list->lmbs_modified < usr_drc_count) {
 		if (drmgr_timed_out())
 			break;
 
-		lmb = get_available_lmb(lmb_head);
+		lmb = get_available_lmb(lmb_list, &pos);
 		if (!lmb)
 			return -1;
 
-		/* Iterate only over the remaining LMBs */
-		lmb_head = lmb->next;
-
 		rc = set_lmb_state(lmb, OFFLINE);
 		if (rc) {
 			lmb->unusable = 1;
@@ -1317,8 +1802,8 @@ static int remove_lmbs(struct lmb_list_head *lmb_list)
 static int mem_remove(void)
 {
 	struct lmb_list_head *lmb_list;
-	struct dr_node *lmb;
 	unsigned int removable = 0;
+	uint32_t i;
 	int rc = 0;
 
 	lmb_list = get_lmbs(LMB_RANDOM_SORT);
@@ -1335,8 +1820,11 @@ static int mem_remove(void)
 		/* Make sure we have enough removable memory to fulfill
 		 * this request
 		 */
-		for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
-			if (lmb->is_removable)
+		for (i = 0; i < lmb_list->lmbs.n_lmbs; i++) {
+			if (removable >= usr_drc_count)
+				break;
+
+			if (lmb_removable(lmb_list, lmb_list->order[i]))
 				removable++;
 		}
 
@@ -1467,42 +1955,111 @@ static int remove_lmb_by_index(uint32_t drc_index)
 				      1 /* Don't report error */);
 }
 
-static int remove_lmb_from_node(struct ppcnuma_node *node, uint32_t count)
+/*
+ * Upper bound of the LMBs handed to the kernel in a single indexed-count
+ * request. The kernel handles such a request as all-or-nothing and rolls
+ * back the already removed LMBs when one of them cannot be removed, so keep
+ * the amount of work lost on a failure reasonable.
+ */
+#define LMB_REMOVE_MAX_RUN	128
+
+static int remove_lmbs_by_ic(uint32_t drc_index, uint32_t count)
 {
-	struct dr_node *lmb;
-	int err, done = 0, unlinked = 0;
+	char cmdbuf[128];
+	int offset;
 
-	say(DEBUG, "Try removing %d / %d LMBs from node %d\n",
-	    count, node->n_lmbs, node->node_id);
+	if (count == 1)
+		return remove_lmb_by_index(drc_index);
+
+	offset = sprintf(cmdbuf, "memory remove indexed-count %u 0x%x",
+			 count, drc_index);
+
+	return do_kernel_dlpar_common(cmdbuf, offset,
+				      1 /* Don't report error */);
+}
 
-	for (lmb = node->lmbs; lmb && done < count; lmb = lmb->lmb_numa_next) {
-		unlinked++;
-		err = remove_lmb_by_index(lmb->drc_index);
+/**
+ * remove_lmb_span
+ * @brief Remove a run of LMBs with contiguous drc indexes
+ *
+ * The whole run is first requested in one go. If the kernel refuses it,
+ * only the LMBs of that run are retried one by one.
+ *
+ * @param node node the LMBs belong to
+ * @param drc_index drc index of the first LMB of the run
+ * @param count number of LMBs in the run
+ * @returns number of LMBs removed
+ */
+static uint32_t remove_lmb_span(struct ppcnuma_node *node, uint32_t drc_index,
+				uint32_t count)
+{
+	uint32_t i, done = 0;
+	int err;
+
+	err = remove_lmbs_by_ic(drc_index, count);
+	if (!err)
+		return count;
+
+	if (count == 1) {
+		say(WARN, "Can't remove LMB node:%d index:0x%x: %s\n",
+		    node->node_id, drc_index, strerror(-err));
+		return 0;
+	}
+
+	say(DEBUG, "Can't remove LMBs node:%d index:0x%x-0x%x: %s, "
+	    "retrying one by one\n", node->node_id, drc_index,
+	    drc_index + count - 1, strerror(-err));
+
+	/* Keep the previous removal order, highest index first */
+	for (i = count; i > 0; i--) {
+		err = remove_lmb_by_index(drc_index + i - 1);
 		if (err)
 			say(WARN, "Can't remove LMB node:%d index:0x%x: %s\n",
-			    node->node_id, lmb->drc_index, strerror(-err));
+			    node->node_id, drc_index + i - 1, strerror(-err));
 		else
 			done++;
 	}
 
-	/*
-	 * Decrement the node LMB's count since whatever is the success
-	 * of the removal operation, it will not be tried again on that
-	 * LMB.
-	 */
-	node->n_lmbs -= unlinked;
+	return done;
+}
+
+static int remove_lmb_from_node(struct ppcnuma_node *node, uint32_t count)
+{
+	uint32_t first, run, todo;
+	int done = 0, unlinked = 0;
+
+	say(DEBUG, "Try removing %d / %d LMBs from node %d\n",
+	    count, node->n_lmbs, node->node_id);
 
 	/*
-	 * Update the node's list of LMB to not process the one we removed or
-	 * tried to removed again.
+	 * LMBs are taken from the end of the node's array and the node LMB's
+	 * count is decremented whatever is the success of the removal
+	 * operation, so that it will not be tried again on that LMB.
+	 *
+	 * The LMBs still to be removed are grouped in runs of contiguous
+	 * drc indexes, each run being removed through a single request.
 	 */
-	node->lmbs = lmb;
+	while (node->n_lmbs && done < count) {
+		todo = count - done;
+
+		first = node->lmbs[--node->n_lmbs];
+		run = 1;
+		while (node->n_lmbs && run < todo &&
+		       run < LMB_REMOVE_MAX_RUN &&
+		       node->lmbs[node->n_lmbs - 1] == first - 1) {
+			first = node->lmbs[--node->n_lmbs];
+			run++;
+		}
+
+		unlinked += run;
+		done += remove_lmb_span(node, first, run);
+	}
 
 	/* Update numa's counters */
 	if (node->n_cpus)
 		numa.lmb_count -= unlinked;
 	else
-		numa.cpuless_node_count -= unlinked;
+		numa.cpuless_lmb_count -= unlinked;
 
 	if (!node->n_lmbs) {
 		node->ratio = 0; /* for sanity only */
@@ -1698,8 +2255,11 @@ static void clear_numa_lmb_links(void)
 	int nid;
 	struct ppcnuma_node *node;
 
-	ppcnuma_foreach_node(&numa, nid, node)
+	ppcnuma_foreach_node(&numa, nid, node) {
+		free(node->lmbs);
 		node->lmbs = NULL;
+		node->lmbs_sz = 0;
+	}
 }
 
 static int numa_based_remove(uint32_t count)
@@ -34,6 +34,8 @@
 #include "dr.h"
 #include "drcpu.h"
 #include "drmem.h"
+#include "common_mem.h"
+#include "cpu_topology.h"
 
 #include "options.c"
 
@@ -44,37 +46,7 @@ int log_fd = 0;
 int min_common_depth;
 int read_dynamic_memory_v2 = 1;
 
-static bool check_node(char *syspath, int node)
-{
-	static char nodepath[PATH_MAX];
-	struct stat sbuf;
-
-	snprintf(nodepath, PATH_MAX, "%s/node%d", syspath, node);
-	say(EXTRA_DEBUG, "checking %s\n", nodepath);
-	return stat(nodepath, &sbuf) == 0;
-}
-
-
-static int find_node(char *syspath, int node_hint)
-{
-	int node;
-
-	if (check_node(syspath, node_hint))
-		return node_hint;
-
-	say(EXTRA_DEBUG, "Checking up to node %d\n", numa_max_node());
-	for (node = 0; node <= numa_max_node(); node++) {
-		if (node == node_hint)
-			continue;
-		if (check_node(syspath, node))
-			return node;
-	}
-
-	return NUMA_NO_NODE;
-}
-
-static void print_mem(struct dr_node *lmb,
-		      struct mem_scn *scn,
+static void print_mem(uint32_t drc_index, uint64_t phys_addr,
 		      int nid, int dtnid,
 		      bool first)
 {
@@ -84,51 +56,66 @@ static void print_mem(struct dr_node *lmb,
 	}
 
 	say(INFO, "0x%x\t%lx\t%d\t%d\n",
-	    lmb->drc_index, scn->phys_addr, nid, dtnid);
+	    drc_index, phys_addr, nid, dtnid);
 }
 
 
 static int compute_mem_score(void)
 {
 	struct lmb_list_head *lmb_list;
-	struct dr_node *lmb;
+	struct lmb_table *table;
 	struct assoc_arrays aa;
 	unsigned long memory_size = 0, memory_badly_binded_size = 0;
+	uint32_t slot;
 	int rc;
 
 	if (get_assoc_arrays(DYNAMIC_RECONFIG_MEM, &aa, min_common_depth))
 		return 1;
 
 	lmb_list = get_lmbs(LMB_NORMAL_SORT);
-	if (lmb_list == NULL || lmb_list->lmbs == NULL) {
+	if (lmb_list == NULL || lmb_list->lmbs.n_lmbs == 0) {
 		say(WARN, "Can't read the LMB list\n");
 		return 1;
 	}
 
+	table = &lmb_list->lmbs;
+
+	if (mem_blocks_scan(MEM_BLOCK_NODE)) {
+		say(WARN, "Can't read the memory blocks\n");
+		free_lmbs(lmb_list);
+		return 1;
+	}
+
 	rc = 1;
-	for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
+	for (slot = 0; slot < table->n_lmbs; slot++) {
+		struct mem_block *mb;
+		uint32_t scn, first_scn, nr_scns;
 		int dtnid, nid;
-		struct mem_scn *scn;
 
-		if (!lmb->is_owned)
+		if (!(table->state[slot] & LMB_OWNED))
 			continue;
 
-		memory_size += lmb->lmb_size;
+		memory_size += table->size[slot];
 
-		dtnid = aa_index_to_node(&aa, lmb->lmb_aa_index);
+		dtnid = aa_index_to_node(&aa, table->aa_index[slot]);
 		if (dtnid == NUMA_NO_NODE) {
 			say(ERROR, "Can't get DT NUMA node of LMB %lx\n",
-			    lmb->lmb_address);
+			    table->address[slot]);
 			goto out_free;
 		}
 
 		say(DEBUG, "Checking LMB %lx DT node:%d aa_index:%d\n",
-		    lmb->lmb_address, dtnid, lmb->lmb_aa_index);
+		    table->address[slot], dtnid, table->aa_index[slot]);
 
-		for (scn = lmb->lmb_mem_scns; scn; scn = scn->next) {
-			nid = find_node(scn->sysfs_path, dtnid);
+		first_scn = lmb_first_scn(table, slot);
+		nr_scns = lmb_nr_scns(table, slot);
+		for (scn = first_scn; scn < first_scn + nr_scns; scn++) {
+			mb = mem_block_get(scn, MEM_BLOCK_NODE);
+			nid = mb ? mb->node : NUMA_NO_NODE;
 			if (nid != dtnid) {
-				print_mem(lmb, scn, nid, dtnid,
+				print_mem(table->drc_index[slot],
+					  (uint64_t)scn * block_sz_bytes,
+					  nid, dtnid,
 					  memory_badly_binded_size == 0);
 				memory_badly_binded_size += block_sz_bytes;
 			}
@@ -166,7 +153,7 @@ static void dump_cpu_table(struct dr_info *dr_info)
 
 		say(DEBUG, "%d-%d\t%d\t%d\n", cpu->cpu_threads->id,
 		    cpu->cpu_threads->id + cpu->cpu_nthreads,
-		    numa_node_of_cpu(cpu->cpu_threads->id), dtnid);
+		    topology_cpu_node(cpu->cpu_threads->id), dtnid);
 	}
 }
 
@@ -194,6 +181,12 @@ static int compute_cpu_score(void)
 		return 1;
 	}
 
+	if (cpu_topology_init()) {
+		say(ERROR, "Failed to read the cpu topology\n");
+		free_cpu_drc_info(&dr_info);
+		return 1;
+	}
+
 	if (output_level >= DEBUG)
 		dump_cpu_table(&dr_info);
 
@@ -203,7 +196,7 @@ static int compute_cpu_score(void)
 
 		dtnid = of_associativity_to_node(cpu->ofdt_path,
 						 min_common_depth);
-		nid = numa_node_of_cpu(cpu->cpu_threads->id);
+		nid = topology_cpu_node(cpu->cpu_threads->id);
 
 		ncpus += cpu->cpu_nthreads;
 		if (dtnid != nid) {
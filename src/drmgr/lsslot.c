@@ -29,6 +29,7 @@
 #include "drpci.h"
 #include "dr.h"
 #include "drmem.h"
+#include "common_mem.h"
 #include "pseries_platform.h"
 
 #include "options.c"
@@ -712,16 +713,33 @@ int lsslot_chrp_phb(void)
 	return 0;
 }
 
+/**
+ * print_lmb_scns
+ * @brief Print the sysfs memory block numbers backing an lmb
+ *
+ * @param table lmb table
+ * @param slot slot of the lmb in the table
+ */
+static void print_lmb_scns(struct lmb_table *table, uint32_t slot)
+{
+	uint32_t first = lmb_first_scn(table, slot);
+	uint32_t nr_scns = lmb_nr_scns(table, slot);
+	uint32_t i;
+
+	/* highest memory block first */
+	for (i = nr_scns; i > 0; i--)
+		printf("%s %u", (i == nr_scns) ? "" : ",", first + i - 1);
+}
+
 int print_drconf_mem(struct lmb_list_head *lmb_list)
 {
-	struct dr_node *lmb;
-	struct mem_scn *scn;
-	int scn_offset = strlen("/sys/devices/system/memory/memory");
+	struct lmb_table *table = &lmb_list->lmbs;
 	char *aa_buf;
 	__be32 *aa;
 	int aa_size, aa_list_sz;
 	int i, rc;
 	uint32_t drc_index = 0;
+	uint32_t n, slot;
 
 	aa_size = get_property_size(DYNAMIC_RECONFIG_MEM,
 				    "ibm,associativity-lookup-arrays");
@@ -742,48 +760,40 @@ int print_drconf_mem(struct lmb_list_head *lmb_list)
 		drc_index = strtol(usr_drc_name, NULL, 0);
 
 	printf("Dynamic Reconfiguration Memory (LMB size 0x%"PRIx64")\n",
-	       lmb_list->lmbs->lmb_size);
+	       table->size[lmb_list->order[0]]);
+
+	for (n = 0; n < table->n_lmbs; n++) {
+		int owned, aa_start, aa_end;
 
-	for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
-		int first = 1;
-		int aa_start, aa_end;
+		slot = lmb_list->order[n];
+		owned = table->state[slot] & LMB_OWNED;
 
-		if (drc_index && drc_index != lmb->drc_index)
+		if (drc_index && drc_index != table->drc_index[slot])
 			continue;
-		else if ((output_level < DEBUG) && !lmb->is_owned)
+		else if ((output_level < DEBUG) && !owned)
 			continue;
 
-		printf("%s: %s\n", lmb->drc_name,
-		       lmb->is_owned ? "" : "Not Owned");
+		printf(": %s\n", owned ? "" : "Not Owned");
 
 		printf("    DRC Index: %x        Address: %"PRIx64"\n",
-		       lmb->drc_index, lmb->lmb_address);
+		       table->drc_index[slot], table->address[slot]);
 		printf("    Removable: %s             Associativity: ",
-		       lmb->is_removable ? "Yes" : "No ");
+		       lmb_removable(lmb_list, slot) ? "Yes" : "No ");
 
-		if (lmb->lmb_aa_index == 0xffffffff) {
+		if (table->aa_index[slot] == 0xffffffff) {
 			printf("Not Set\n");
 		} else {
-			printf("(index: %d) ", lmb->lmb_aa_index);
-			aa_start = lmb->lmb_aa_index * aa_list_sz;
+			printf("(index: %d) ", table->aa_index[slot]);
+			aa_start = table->aa_index[slot] * aa_list_sz;
 			aa_end = aa_start + aa_list_sz;
 			for (i = aa_start; i < aa_end; i++)
 				printf("%d ", be32toh(aa[i]));
 			printf("\n");
 		}
 
-		if (lmb->is_owned) {
+		if (owned) {
 			printf("    Section(s):");
-			for (scn = lmb->lmb_mem_scns; scn; scn = scn->next) {
-				if (first) {
-					printf(" %s",
-					       &scn->sysfs_path[scn_offset]);
-					first = 0;
-				} else
-					printf(", %s",
-					       &scn->sysfs_path[scn_offset]);
-			}
-
+			print_lmb_scns(table, slot);
 			printf("\n");
 		}
 	}
@@ -795,47 +805,45 @@ int print_drconf_mem(struct lmb_list_head *lmb_list)
 int lsslot_chrp_mem(void)
 {
 	struct lmb_list_head *lmb_list;
-	struct dr_node *lmb;
-	struct mem_scn *scn;
-	int scn_offset = strlen("/sys/devices/system/memory/memory");
+	struct lmb_table *table;
+	char path[DR_PATH_MAX];
 	int lmb_offset = strlen(OFDT_BASE);
+	uint32_t n, slot;
 
 	lmb_list = get_lmbs(LMB_NORMAL_SORT);
-	if (lmb_list == NULL || lmb_list->lmbs == NULL)
+	if (lmb_list == NULL || lmb_list->lmbs.n_lmbs == 0)
 		return -1;
 
+	table = &lmb_list->lmbs;
+
+	/* Every owned lmb is printed with its removability, read all of
+	 * the memory blocks' removable attributes at once.
+	 */
+	mem_blocks_scan(MEM_BLOCK_REMOVABLE);
 	
 	if (lmb_list->drconf_buf) {
 		print_drconf_mem(lmb_list);
 	} else {
-		printf("lmb size: 0x%"PRIx64"\n", lmb_list->lmbs->lmb_size);
+		printf("lmb size: 0x%"PRIx64"\n",
+		       table->size[lmb_list->order[0]]);
 		printf("%-20s  %-5s  %c  %s\n", "Memory Node", "Name", 'R',
 		       "Sections");
 		printf("%-20s  %-5s  %c  %s\n", "-----------", "----", '-',
 		       "--------");
 
-		for (lmb = lmb_list->lmbs; lmb; lmb = lmb->next) {
-			int first = 1;
+		for (n = 0; n < table->n_lmbs; n++) {
+			slot = lmb_list->order[n];
 
-			if (!lmb->is_owned)
+			if (!(table->state[slot] & LMB_OWNED))
 				continue;
 
-			if (!lmb_list->drconf_buf)
-				printf("%-20s  ", &lmb->ofdt_path[lmb_offset]);
+			lmb_ofdt_path(lmb_list, slot, path, DR_PATH_MAX);
+			printf("%-20s  ", &path[lmb_offset]);
 
-			printf("%-5s  %c ", lmb->drc_name,
-			       lmb->is_removable ? 'Y' : 'N');
+			printf("%-5s  %c ", "",
+			       lmb_removable(lmb_list, slot) ? 'Y' : 'N');
 		
-			for (scn = lmb->lmb_mem_scns; scn; scn = scn->next) {
-				if (first) {
-					printf(" %s",
-					       &scn->sysfs_path[scn_offset]);
-					first = 0;
-				} else
-					printf(", %s",
-					       &scn->sysfs_path[scn_offset]);
-			}
-
+			print_lmb_scns(table, slot);
 			printf("\n");
 		}
 	}
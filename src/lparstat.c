@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
+#include <math.h>
 #include <getopt.h>
 #include <unistd.h>
 #include <errno.h>
@@ -36,6 +38,8 @@
 #include "lparstat.h"
 #include "pseries_platform.h"
 #include "cpu_info_helpers.h"
+#include "cpu_topology.h"
+#include "interval_timer.h"
 #include <time.h>
 
 #define LPARCFG_FILE	"/proc/ppc64/lparcfg"
@@ -46,27 +50,199 @@ static bool o_legacy = false;
 static bool o_scaled = false;
 static bool o_security = false;
 
+/* Reporting on a recording rather than on the running system */
+static bool replaying = false;
+
+enum output_format {
+	OUTPUT_TEXT,
+	OUTPUT_JSON,
+	OUTPUT_CSV,
+};
+
+static enum output_format o_format = OUTPUT_TEXT;
+
+enum breakdown_level {
+	BREAKDOWN_NONE,
+	BREAKDOWN_CPU,
+	BREAKDOWN_CORE,
+	BREAKDOWN_NODE,
+};
+
+static enum breakdown_level o_breakdown = BREAKDOWN_NONE;
+
 static int threads_per_cpu;
 static int cpus_in_system;
 static int threads_in_system;
 
+/*
+ * Indexed by cpu number, only the online cpus have their sysfs files open.
+ * The others have spurr set to -1.
+ */
 static cpu_sysfs_fd *cpu_sysfs_fds;
-static cpu_set_t *online_cpus;
+static int nr_cpu_sysfs_fds;
+
+/*
+ * The /proc and sysfs files read on every sample are opened once and
+ * re-read with pread() into a buffer that is only reallocated if the file
+ * outgrows it.
+ */
+struct proc_file {
+	const char	*path;
+	int		fd;
+	char		*buf;
+	size_t		size;
+};
+
+#define PROC_FILE_BUF_SZ	4096
+
+static struct proc_file proc_lparcfg = { LPARCFG_FILE, -1 };
+static struct proc_file proc_stat = { "/proc/stat", -1 };
+static struct proc_file proc_interrupts = { "/proc/interrupts", -1 };
+
+/*
+ * Numeric values of the SE_DELTA entries for the current and the previous
+ * samples, swapped by update_sysdata(). The other entries only keep their
+ * current value, in system_data[].
+ */
+struct sysdata_sample {
+	long long	value[SE_MAX];
+	bool		valid[SE_MAX];
+};
+
+static struct sysdata_sample samples[2];
+static struct sysdata_sample *cur_sample = &samples[0];
+static struct sysdata_sample *old_sample = &samples[1];
+
+/* system_data[] sorted by name, for get_sysentry() */
+static struct sysentry *sysentry_index[SE_MAX];
+
+static int sysentry_sort_cmp(const void *a, const void *b)
+{
+	const struct sysentry *sa = *(struct sysentry * const *)a;
+	const struct sysentry *sb = *(struct sysentry * const *)b;
+
+	return strcmp(sa->name, sb->name);
+}
+
+static int sysentry_find_cmp(const void *name, const void *elem)
+{
+	const struct sysentry *se = *(struct sysentry * const *)elem;
+
+	return strcmp(name, se->name);
+}
+
+static void init_sysentry_index(void)
+{
+	int i;
+
+	for (i = 0; i < SE_MAX; i++)
+		sysentry_index[i] = &system_data[i];
+
+	qsort(sysentry_index, SE_MAX, sizeof(sysentry_index[0]),
+	      sysentry_sort_cmp);
+}
+
+struct sysentry *get_sysentry(const char *name)
+{
+	struct sysentry **se;
+
+	if (!sysentry_index[0])
+		init_sysentry_index();
+
+	se = bsearch(name, sysentry_index, SE_MAX, sizeof(sysentry_index[0]),
+		     sysentry_find_cmp);
+
+	return se ? *se : NULL;
+}
+
+static inline int sysentry_id(struct sysentry *se)
+{
+	return se - system_data;
+}
+
+static long long se_num(int id)
+{
+	if (system_data[id].flags & SE_DELTA)
+		return cur_sample->value[id];
+
+	return system_data[id].num;
+}
+
+static bool se_valid(int id)
+{
+	if (system_data[id].flags & SE_DELTA)
+		return cur_sample->valid[id];
+
+	return system_data[id].valid;
+}
+
+static void se_set_num(int id, long long value)
+{
+	struct sysentry *se = &system_data[id];
+
+	if (se->flags & SE_DELTA) {
+		cur_sample->value[id] = value;
+		cur_sample->valid[id] = true;
+	} else {
+		se->num = value;
+		se->valid = true;
+	}
+
+	/* Displayed from the numeric value from now on */
+	se->value[0] = '\0';
+}
+
+static void se_set_str(struct sysentry *se, const char *value)
+{
+	long long num;
+	char *end;
+
+	num = strtoll(value, &end, 10);
+	if (end != value)
+		se_set_num(sysentry_id(se), num);
+
+	snprintf(se->value, SYSDATA_VALUE_SZ, "%s", value);
+}
+
+/* Whether the entries the get callback of an SE_GET_NUM entry reads are set */
+static bool se_get_valid(int id)
+{
+	switch (id) {
+	case SE_ACTIVE_CPUS_IN_POOL:
+		return se_valid(SE_PHYSICAL_PROCS_ALLOCATED_TO_VIRTUALIZATION);
+	case SE_PHYS_CPU_PERCENTAGE:
+		return se_valid(SE_DESENTCAP) &&
+		       se_valid(SE_PARTITION_ACTIVE_PROCESSORS);
+	case SE_MEMORY_MODE:
+		return se_valid(SE_ENTITLED_MEMORY_POOL_NUMBER);
+	default:
+		return se_valid(id);
+	}
+}
 
-struct sysentry *get_sysentry(char *name)
+void get_sysdata(int id, char **descr, char *value)
 {
-	struct sysentry *se = &system_data[0];
+	struct sysentry *se = &system_data[id];
 
-	while (se->name[0] != '\0') {
-		if (!strcmp(se->name, name))
-			return se;
-		se++;
+	if (se->get && (se->flags & SE_GET_NUM) && !se_get_valid(id)) {
+		sprintf(value, SE_NOT_VALID);
+	} else if (replaying && (se->flags & SE_LIVE)) {
+		/* Not part of the recording */
+		sprintf(value, SE_NOT_VALID);
+	} else if (se->get) {
+		se->get(se, value);
+	} else if (se->value[0] != '\0') {
+		sprintf(value, "%s", se->value);
+	} else if (se_valid(id)) {
+		sprintf(value, "%lld", se_num(id));
+	} else {
+		sprintf(value, SE_NOT_VALID);
 	}
 
-	return NULL;
+	*descr = se->descr;
 }
 
-void get_sysdata(char *name, char **descr, char *value)
+void get_sysdata_by_name(char *name, char **descr, char *value)
 {
 	struct sysentry *se;
 
@@ -77,15 +253,7 @@ void get_sysdata(char *name, char **descr, char *value)
 		return;
 	}
 
-	if (se->get) {
-		se->get(se, value);
-	} else if (se->value[0] == '\0') {
-		sprintf(value, SE_NOT_VALID);
-	} else {
-		sprintf(value, "%s", se->value);
-	}
-
-	*descr = se->descr;
+	get_sysdata(sysentry_id(se), descr, value);
 }
 
 static int is_smt_capable(void)
@@ -98,11 +266,6 @@ static int parse_smt_state(void)
 	return __do_smt(false, cpus_in_system, threads_per_cpu, false);
 }
 
-static int get_one_smt_state(int core)
-{
-	return __get_one_smt_state(core, threads_per_cpu);
-}
-
 static int assign_read_fd(const char *path)
 {
 	int rc = 0;
@@ -115,158 +278,303 @@ static int assign_read_fd(const char *path)
 	return rc;
 }
 
-static void close_cpu_sysfs_fds(int threads_in_system)
+static void close_cpu_sysfs_fd(cpu_sysfs_fd *fds)
+{
+	if (fds->purr >= 0)
+		close(fds->purr);
+	if (fds->spurr >= 0)
+		close(fds->spurr);
+	if (fds->idle_purr >= 0)
+		close(fds->idle_purr);
+	if (fds->idle_spurr >= 0)
+		close(fds->idle_spurr);
+
+	fds->purr = fds->spurr = fds->idle_purr = fds->idle_spurr = -1;
+}
+
+static void close_cpu_sysfs_fds(void)
 {
 	int i;
 
-	for (i = 0; i < threads_in_system && cpu_sysfs_fds[i].spurr; i++) {
-		close(cpu_sysfs_fds[i].spurr);
-		close(cpu_sysfs_fds[i].idle_purr);
-		close(cpu_sysfs_fds[i].idle_spurr);
-	}
+	for (i = 0; i < nr_cpu_sysfs_fds; i++)
+		close_cpu_sysfs_fd(&cpu_sysfs_fds[i]);
 
 	free(cpu_sysfs_fds);
+	cpu_sysfs_fds = NULL;
+	nr_cpu_sysfs_fds = 0;
 }
 
-static int assign_cpu_sysfs_fds(int threads_in_system)
+static int resize_cpu_sysfs_fds(int nr)
 {
-	int cpu_idx, i;
-	char sysfs_file_path[SYSFS_PATH_MAX];
+	cpu_sysfs_fd *fds;
+	int i;
 
-	cpu_sysfs_fds =
-		(cpu_sysfs_fd*)calloc(sizeof(cpu_sysfs_fd), threads_in_system);
-	if (!cpu_sysfs_fds) {
+	if (nr <= nr_cpu_sysfs_fds)
+		return 0;
+
+	fds = realloc(cpu_sysfs_fds, nr * sizeof(*fds));
+	if (!fds) {
 		fprintf(stderr, "Failed to allocate memory for sysfs file descriptors\n");
 		return -1;
 	}
 
-	for (cpu_idx = 0, i = 0; i < threads_in_system; i++) {
-		if (!cpu_online(i))
-			continue;
+	for (i = nr_cpu_sysfs_fds; i < nr; i++) {
+		memset(&fds[i], 0, sizeof(fds[i]));
+		fds[i].cpu = i;
+		fds[i].node = -1;
+		fds[i].purr = fds[i].spurr = -1;
+		fds[i].idle_purr = fds[i].idle_spurr = -1;
+	}
 
-		cpu_sysfs_fds[cpu_idx].cpu = i;
+	cpu_sysfs_fds = fds;
+	nr_cpu_sysfs_fds = nr;
+	return 0;
+}
 
-		snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_SPURR, i);
-		cpu_sysfs_fds[cpu_idx].spurr = assign_read_fd(sysfs_file_path);
-		if (cpu_sysfs_fds[cpu_idx].spurr == -1)
-			goto error;
+static int open_cpu_sysfs_fd(cpu_sysfs_fd *fds)
+{
+	char sysfs_file_path[SYSFS_PATH_MAX];
+	int cpu = fds->cpu;
 
-		snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_IDLE_PURR, i);
-		cpu_sysfs_fds[cpu_idx].idle_purr = assign_read_fd(sysfs_file_path);
-		if (cpu_sysfs_fds[cpu_idx].idle_purr == -1)
-			goto error;
+	if (o_breakdown != BREAKDOWN_NONE) {
+		fds->node = topology_cpu_node(cpu);
 
-		snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_IDLE_SPURR, i);
-		cpu_sysfs_fds[cpu_idx].idle_spurr = assign_read_fd(sysfs_file_path);
-		if (cpu_sysfs_fds[cpu_idx].idle_spurr == -1)
+		snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_PURR, cpu);
+		fds->purr = assign_read_fd(sysfs_file_path);
+		if (fds->purr == -1)
 			goto error;
-
-		cpu_idx++;
 	}
 
-	/* Mark extra slots for offline threads unset, see parse_sysfs_values */
-	for (; cpu_idx < threads_in_system; cpu_idx++)
-		cpu_sysfs_fds[cpu_idx].spurr = -1;
+	snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_SPURR, cpu);
+	fds->spurr = assign_read_fd(sysfs_file_path);
+	if (fds->spurr == -1)
+		goto error;
+
+	snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_IDLE_PURR, cpu);
+	fds->idle_purr = assign_read_fd(sysfs_file_path);
+	if (fds->idle_purr == -1)
+		goto error;
+
+	snprintf(sysfs_file_path, SYSFS_PATH_MAX, SYSFS_PERCPU_IDLE_SPURR, cpu);
+	fds->idle_spurr = assign_read_fd(sysfs_file_path);
+	if (fds->idle_spurr == -1)
+		goto error;
 
+	memset(&fds->cur, 0, sizeof(fds->cur));
+	memset(&fds->prev, 0, sizeof(fds->prev));
 	return 0;
+
 error:
-	fprintf(stderr, "Failed to open %s: %s\n",
+	if (cpu_online(cpu))
+		fprintf(stderr, "Failed to open %s: %s\n",
 			sysfs_file_path, strerror(errno));
-	close_cpu_sysfs_fds(threads_in_system);
+	close_cpu_sysfs_fd(fds);
 	return -1;
 }
 
-int parse_sysfs_values(void)
+static int read_cpu_sysfs_value(int fd, unsigned long long *value)
 {
-	unsigned long long spurr, idle_spurr, idle_purr, value;
 	char line[SYSDATA_VALUE_SZ];
-	struct sysentry *se;
-	int i, rc;
+	int rc;
+
+	rc = pread(fd, (void *)line, sizeof(line) - 1, 0);
+	if (rc == -1)
+		return -1;
+
+	line[rc] = '\0';
+	*value = strtoull(line, NULL, 16);
+	return 0;
+}
+
+static int read_cpu_sysfs_sample(cpu_sysfs_fd *fds, const char **attr)
+{
+	struct cpu_sysfs_sample *sample = &fds->cur;
+
+	*attr = "purr";
+	if (fds->purr >= 0 && read_cpu_sysfs_value(fds->purr, &sample->purr))
+		return -1;
+
+	*attr = "spurr";
+	if (read_cpu_sysfs_value(fds->spurr, &sample->spurr))
+		return -1;
+
+	*attr = "idle_purr";
+	if (read_cpu_sysfs_value(fds->idle_purr, &sample->idle_purr))
+		return -1;
+
+	*attr = "idle_spurr";
+	if (read_cpu_sysfs_value(fds->idle_spurr, &sample->idle_spurr))
+		return -1;
+
+	return 0;
+}
+
+/**
+ * parse_sysfs_values
+ * @brief Sample the per cpu spurr, idle_purr and idle_spurr counters
+ *
+ * The partition totals are advanced by the per cpu deltas, so that cpus
+ * going offline or coming online between two samples do not make them
+ * jump. A cpu that came online is only counted from its first sample.
+ *
+ * @returns 0 on success, -1 on error
+ */
+int parse_sysfs_values(void)
+{
+	unsigned long long spurr, idle_spurr, idle_purr;
+	const char *attr;
+	cpu_sysfs_fd *fds;
+	int i;
 
 	spurr = idle_spurr = idle_purr = 0UL;
 
-	for (i = 0; (i < threads_in_system) && (cpu_sysfs_fds[i].spurr >= 0); i++) {
-		rc = pread(cpu_sysfs_fds[i].spurr, (void *)line, sizeof(line), 0);
-		if (rc == -1) {
-			fprintf(stderr, "Failed to read /sys/devices/system/cpu/cpu%d/spurr\n",
-					cpu_sysfs_fds[i].cpu);
-			goto check_cpu_hotplug;
+	for (i = 0; i < nr_cpu_sysfs_fds; i++) {
+		fds = &cpu_sysfs_fds[i];
+		if (fds->spurr < 0)
+			continue;
+
+		fds->prev = fds->cur;
+		if (read_cpu_sysfs_sample(fds, &attr)) {
+			/* Went offline since the online mask was read */
+			if (!cpu_online(fds->cpu)) {
+				close_cpu_sysfs_fd(fds);
+				continue;
+			}
+
+			fprintf(stderr, "Failed to read /sys/devices/system/cpu/cpu%d/%s\n",
+				fds->cpu, attr);
+			return -1;
 		}
 
-		value = strtoll(line, NULL, 16);
-		spurr += value;
+		if (fds->hotplugged) {
+			fds->prev = fds->cur;
+			fds->hotplugged = false;
+		}
 
-		rc = pread(cpu_sysfs_fds[i].idle_purr, (void *)line, sizeof(line), 0);
-		if (rc == -1) {
-			fprintf(stderr, "Failed to read /sys/devices/system/cpu/cpu%d/idle_purr\n",
-					cpu_sysfs_fds[i].cpu);
-			goto check_cpu_hotplug;
+		spurr += fds->cur.spurr - fds->prev.spurr;
+		idle_purr += fds->cur.idle_purr - fds->prev.idle_purr;
+		idle_spurr += fds->cur.idle_spurr - fds->prev.idle_spurr;
+	}
+
+	if (old_sample->valid[SE_SPURR]) {
+		spurr += old_sample->value[SE_SPURR];
+		idle_purr += old_sample->value[SE_IDLE_PURR];
+		idle_spurr += old_sample->value[SE_IDLE_SPURR];
+	}
+
+	se_set_num(SE_SPURR, spurr);
+	se_set_num(SE_IDLE_PURR, idle_purr);
+	se_set_num(SE_IDLE_SPURR, idle_spurr);
+
+	return 0;
+}
+
+/**
+ * read_proc_file
+ * @brief Read the current contents of a /proc file
+ *
+ * @param pf proc file to read
+ * @returns pointer to the nul terminated contents, NULL on error
+ */
+static char *read_proc_file(struct proc_file *pf)
+{
+	size_t len = 0;
+	ssize_t rc;
+
+	if (pf->fd < 0) {
+		pf->fd = open(pf->path, O_RDONLY);
+		if (pf->fd < 0) {
+			fprintf(stderr, "Could not open %s\n", pf->path);
+			return NULL;
 		}
+	}
 
-		value = strtoll(line, NULL, 16);
-		idle_purr += value;
+	while (1) {
+		if (pf->size - len < 2) {
+			size_t size = pf->size ? pf->size * 2 : PROC_FILE_BUF_SZ;
+			char *buf;
 
-		rc = pread(cpu_sysfs_fds[i].idle_spurr, (void *)line, sizeof(line), 0);
+			buf = realloc(pf->buf, size);
+			if (!buf) {
+				fprintf(stderr, "Failed to allocate memory for %s\n",
+					pf->path);
+				return NULL;
+			}
+
+			pf->buf = buf;
+			pf->size = size;
+		}
+
+		rc = pread(pf->fd, pf->buf + len, pf->size - len - 1, len);
 		if (rc == -1) {
-			fprintf(stderr, "Failed to read /sys/devices/system/cpu/cpu%d/idle_spurr\n",
-					cpu_sysfs_fds[i].cpu);
-			goto check_cpu_hotplug;
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "Could not read %s: %s\n", pf->path,
+				strerror(errno));
+			return NULL;
 		}
 
-		value = strtoll(line, NULL, 16);
-		idle_spurr += value;
+		if (rc == 0)
+			break;
+
+		len += rc;
 	}
 
-	se = get_sysentry("spurr");
-	sprintf(se->value, "%llu", spurr);
-	se = get_sysentry("idle_purr");
-	sprintf(se->value, "%llu", idle_purr);
-	se = get_sysentry("idle_spurr");
-	sprintf(se->value, "%llu", idle_spurr);
+	pf->buf[len] = '\0';
+	return pf->buf;
+}
+
+/* Parse the decimal number at *p, skipping leading blanks */
+static unsigned long long scan_ull(char **p)
+{
+	unsigned long long value = 0;
+	char *s = *p;
 
-	return 0;
+	while (*s == ' ' || *s == '\t')
+		s++;
 
-check_cpu_hotplug:
-	if(!cpu_online(cpu_sysfs_fds[i].cpu))
-		return 1;
+	while (*s >= '0' && *s <= '9')
+		value = value * 10 + (*s++ - '0');
 
-	return rc;
+	*p = s;
+	return value;
 }
 
 static void sig_int_handler(int signal)
 {
-	close_cpu_sysfs_fds(threads_in_system);
+	close_cpu_sysfs_fds();
 	exit(1);
 }
 
-long long get_delta_value(char *se_name)
+long long get_delta_value(int id)
 {
-	long long value, old_value;
-	struct sysentry *se;
+	long long old_value = 0;
 
-	se = get_sysentry(se_name);
-	if (se->value[0] == '\0')
+	if (!cur_sample->valid[id])
 		return 0LL;
 
-	value = strtoll(se->value, NULL, 0);
-	old_value = strtoll(se->old_value, NULL, 0);
+	if (old_sample->valid[id])
+		old_value = old_sample->value[id];
 
-	return (value - old_value);
+	return cur_sample->value[id] - old_value;
 }
 
 void get_time()
 {
-	struct sysentry *se;
-	struct timespec ts;
-	int err;
+	long long now;
 
-	err = clock_gettime(CLOCK_BOOTTIME, &ts);
-	if (err)
+	now = clock_ns(CLOCK_BOOTTIME);
+	if (now == -1)
 		return;
 
-	se = get_sysentry("time");
-	sprintf(se->value, "%lld",
-		(long long)ts.tv_sec);
+	se_set_num(SE_TIME, now);
+}
+
+/* Seconds elapsed between the two samples, or since boot */
+static double get_elapsed_time(void)
+{
+	return (double)get_delta_value(SE_TIME) / NSEC_PER_SEC;
 }
 
 int get_time_base()
@@ -274,7 +582,6 @@ int get_time_base()
 	FILE *f;
 	char buf[80];
 	char *tb = NULL;
-	struct sysentry *se;
 
 	f = fopen("/proc/cpuinfo", "r");
 	if (!f) {
@@ -293,24 +600,20 @@ int get_time_base()
 	if (!tb)
 		return -1;
 
-	se = get_sysentry("timebase");
-	sprintf(se->value, "%s", tb);
+	se_set_str(&system_data[SE_TIMEBASE], tb);
 	return 0;
 }
 
 double get_scaled_tb(void)
 {
 	double elapsed, timebase;
-	struct sysentry *se;
 	int online_cores;
 
-	se = get_sysentry("online_cores");
-	online_cores = atoi(se->value);
+	online_cores = se_num(SE_ONLINE_CORES);
 
-	elapsed = get_delta_value("time");
+	elapsed = get_elapsed_time();
 
-	se = get_sysentry("timebase");
-	timebase = atoi(se->value);
+	timebase = se_num(SE_TIMEBASE);
 
 	return (timebase * elapsed) * online_cores;
 }
@@ -319,7 +622,6 @@ int get_nominal_frequency(void)
 {
 	FILE *f;
 	char buf[80];
-	struct sysentry *se;
 	char *nfreq = NULL;
 
 	f = fopen("/proc/cpuinfo", "r");
@@ -342,54 +644,49 @@ int get_nominal_frequency(void)
 		return -1;
 	}
 
-	se = get_sysentry("nominal_freq");
-	snprintf(se->value, sizeof(se->value), "%s", nfreq);
+	se_set_str(&system_data[SE_NOMINAL_FREQ], nfreq);
 
 	return 0;
 }
 
 void get_effective_frequency()
 {
-	struct sysentry *se;
+	char buf[SYSDATA_VALUE_SZ];
 	double delta_purr, delta_spurr;
 	double nominal_freq, effective_freq;
 
-	se = get_sysentry("nominal_freq");
-	nominal_freq = strtol(se->value, NULL, 10);
+	nominal_freq = se_num(SE_NOMINAL_FREQ);
 
 	/*
 	 * Calculate the Effective Frequency (EF)
 	 * EF = (delta SPURR / delta PURR) * nominal frequency
 	 */
-	delta_purr = get_delta_value("purr");
-	delta_spurr = get_delta_value("spurr");
+	delta_purr = get_delta_value(SE_PURR);
+	delta_spurr = get_delta_value(SE_SPURR);
 
 	effective_freq = (delta_spurr / delta_purr) * nominal_freq;
 
-	se = get_sysentry("effective_freq");
-	sprintf(se->value, "%f", effective_freq);
+	snprintf(buf, sizeof(buf), "%f", effective_freq);
+	se_set_str(&system_data[SE_EFFECTIVE_FREQ], buf);
 }
 
 void get_cpu_physc(struct sysentry *unused_se, char *buf)
 {
-	struct sysentry *se;
 	float elapsed;
 	float delta_purr;
 	float timebase, physc;
 	float delta_tb;
 
-	delta_purr = get_delta_value("purr");
+	delta_purr = get_delta_value(SE_PURR);
 
-	se = get_sysentry("tbr");
-	if (se->old_value[0] != '\0') {
-		delta_tb = get_delta_value("tbr");
+	if (old_sample->valid[SE_TBR]) {
+		delta_tb = get_delta_value(SE_TBR);
 
 		physc = delta_purr / delta_tb;
 	} else {
-		elapsed = get_delta_value("time");
+		elapsed = get_elapsed_time();
 
-		se = get_sysentry("timebase");
-		timebase = atoi(se->value);
+		timebase = se_num(SE_TIMEBASE);
 
 		physc = delta_purr/timebase/elapsed;
 	}
@@ -403,31 +700,26 @@ void get_per_entc(struct sysentry *unused_se, char *buf)
 	char physc[32];
 	char entc[32];
 
-	get_sysdata("DesEntCap", &descr, entc);
-	get_sysdata("physc", &descr, physc);
+	get_sysdata(SE_DESENTCAP, &descr, entc);
+	get_sysdata(SE_PHYSC, &descr, physc);
 
 	sprintf(buf, "%.2f", atof(physc) / atof(entc) * 100.0);
 }
 
 void get_cpu_app(struct sysentry *unused_se, char *buf)
 {
-	struct sysentry *se;
 	float timebase, app, elapsed_time;
 	long long new_app, old_app;
 
-	elapsed_time = get_delta_value("time");
+	elapsed_time = get_elapsed_time();
 
-	se = get_sysentry("timebase");
-	timebase = atof(se->value);
+	timebase = se_num(SE_TIMEBASE);
 
-	se = get_sysentry("pool_idle_time");
-	new_app = strtoll(se->value, NULL, 0);
-	if (se->old_value[0] == '\0') {
-		se = get_sysentry("boot_pool_idle_time");
-		old_app = strtoll(se->value, NULL, 0);
-	} else {
-		old_app = strtoll(se->old_value, NULL, 0);
-	}
+	new_app = se_num(SE_POOL_IDLE_TIME);
+	if (!old_sample->valid[SE_POOL_IDLE_TIME])
+		old_app = se_num(SE_BOOT_POOL_IDLE_TIME);
+	else
+		old_app = old_sample->value[SE_POOL_IDLE_TIME];
 
 	app = (new_app - old_app)/timebase/elapsed_time;
 	sprintf(buf, "%.2f", app);
@@ -436,13 +728,9 @@ void get_cpu_app(struct sysentry *unused_se, char *buf)
 static double round_off_freq(void)
 {
 	double effective_freq, nominal_freq, freq;
-	struct sysentry *se;
 
-	se = get_sysentry("effective_freq");
-	effective_freq = strtod(se->value, NULL);
-
-	se = get_sysentry("nominal_freq");
-	nominal_freq = strtod(se->value, NULL);
+	effective_freq = strtod(system_data[SE_EFFECTIVE_FREQ].value, NULL);
+	nominal_freq = se_num(SE_NOMINAL_FREQ);
 
 	freq = ((int)((effective_freq/nominal_freq * 100)+ 0.44) -
 	       (effective_freq/nominal_freq * 100)) /
@@ -457,8 +745,8 @@ void get_cpu_util_purr(struct sysentry *unused_se, char *buf)
 	double physc;
 
 	delta_tb = get_scaled_tb();
-	delta_purr = get_delta_value("purr");
-	delta_idle_purr = get_delta_value("idle_purr");
+	delta_purr = get_delta_value(SE_PURR);
+	delta_idle_purr = get_delta_value(SE_IDLE_PURR);
 
 	/*
 	 * Given that these values are read from different
@@ -483,12 +771,12 @@ void get_cpu_idle_purr(struct sysentry *unused_se, char *buf)
 	char mode[32];
 
 	delta_tb = get_scaled_tb();
-	delta_purr = get_delta_value("purr");
-	delta_idle_purr = get_delta_value("idle_purr");
+	delta_purr = get_delta_value(SE_PURR);
+	delta_idle_purr = get_delta_value(SE_IDLE_PURR);
 
-	get_sysdata("shared_processor_mode", &descr, mode);
+	get_sysdata(SE_SHARED_PROCESSOR_MODE, &descr, mode);
 	if (!strcmp(mode, "Dedicated"))
-		get_sysdata("DedDonMode", &descr, mode);
+		get_sysdata(SE_DEDDONMODE, &descr, mode);
 
 	/*
 	 * Given that these values are read from different
@@ -525,8 +813,8 @@ void get_cpu_util_spurr(struct sysentry *unused_se, char *buf)
 	double physc, rfreq;
 
 	delta_tb = get_scaled_tb();
-	delta_spurr = get_delta_value("spurr");
-	delta_idle_spurr = get_delta_value("idle_spurr");
+	delta_spurr = get_delta_value(SE_SPURR);
+	delta_idle_spurr = get_delta_value(SE_IDLE_SPURR);
 
 	physc = (delta_spurr - delta_idle_spurr) / delta_tb;
 	physc *= 100.00;
@@ -546,12 +834,12 @@ void get_cpu_idle_spurr(struct sysentry *unused_se, char *buf)
 	char mode[32];
 
 	delta_tb = get_scaled_tb();
-	delta_spurr = get_delta_value("spurr");
-	delta_idle_spurr = get_delta_value("idle_spurr");
+	delta_spurr = get_delta_value(SE_SPURR);
+	delta_idle_spurr = get_delta_value(SE_IDLE_SPURR);
 
-	get_sysdata("shared_processor_mode", &descr, mode);
+	get_sysdata(SE_SHARED_PROCESSOR_MODE, &descr, mode);
 	if (!strcmp(mode, "Dedicated"))
-		get_sysdata("DedDonMode", &descr, mode);
+		get_sysdata(SE_DEDDONMODE, &descr, mode);
 
 	if (delta_spurr > delta_tb)
 		delta_spurr = delta_tb;
@@ -575,142 +863,103 @@ void get_cpu_idle_spurr(struct sysentry *unused_se, char *buf)
 
 int parse_lparcfg()
 {
-	FILE *f;
-	char line[128];
-	char *first_line;
+	char *line, *next;
 
-	f = fopen(LPARCFG_FILE, "r");
-	if (!f) {
-		fprintf(stderr, "Could not open %s\n", LPARCFG_FILE);
+	line = read_proc_file(&proc_lparcfg);
+	if (!line)
 		return -1;
-	}
 
 	/* parse the file skipping the first line */
-	first_line = fgets(line, 128, f);
-	if (!first_line) {
-		fclose(f);
+	line = strchr(line, '\n');
+	if (!line) {
 		fprintf(stderr, "Could not read first line of %s\n",
 			LPARCFG_FILE);
 		return -1;
 	}
 
-	while (fgets(line, 128, f) != NULL) {
-		char *name, *value, *nl;
+	for (line++; *line != '\0'; line = next) {
+		char *value;
 		struct sysentry *se;
 
-		if (line[0] == '\n')
-			continue;
+		next = strchr(line, '\n');
+		if (next)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
 
-		name = &line[0];
 		value = strchr(line, '=');
-		*value = '\0';
-		value++;
+		if (!value)
+			continue;
 
-		nl = strchr(value, '\n');
-		*nl = '\0';
-		
-		se = get_sysentry(name);
-		if (se) {
-			strncpy(se->value, value, SYSDATA_VALUE_SZ - 1);
-			se->value[SYSDATA_VALUE_SZ - 1] = '\0';
-		}
+		*value++ = '\0';
+
+		se = get_sysentry(line);
+		if (se)
+			se_set_str(se, value);
 	}
 
-	fclose(f);
 	return 0;
 }
 
 int parse_proc_ints()
 {
-	FILE *f;
-	char *line;
-	size_t n = 0;
-	char *value;
-	struct sysentry *se;
+	char *buf, *value;
 	long long int phint = 0;
-	const char *delim = " ";
 
-	f = fopen("/proc/interrupts", "r");
-	if (!f) {
-		fprintf(stderr, "Could not open /proc/interrupts\n");
+	buf = read_proc_file(&proc_interrupts);
+	if (!buf)
 		return -1;
-	}
 
-	while (getline(&line, &n, f) != -1) {
-		/* we just need the SPU line */
-		if (!strstr(line, "SPU:"))
-			continue;
+	/* we just need the SPU line, summed over all the cpus */
+	value = strstr(buf, "SPU:");
+	if (value) {
+		value += strlen("SPU:");
 
-		/* target line. omit the 'SPU:' */
-		value = strtok(line, delim);
-		if (!value)
-			break;
+		while (1) {
+			while (*value == ' ')
+				value++;
 
-		while ((value = strtok(NULL, delim)) && value[0] != 'S') {
-			int v;
-			v = atoi(value);
-			phint += v;
-		}
+			if (*value < '0' || *value > '9')
+				break;
 
-		/* skim the rest of the lines */
-		break;
+			phint += scan_ull(&value);
+		}
 	}
 
-	free(line);
-	fclose(f);
-
-	se = get_sysentry("phint");
-	sprintf(se->value, "%lld", phint);
+	se_set_num(SE_PHINT, phint);
 
 	return 0;
 }
 
 int parse_proc_stat()
 {
-	FILE *f;
-	char line[128];
 	char *value;
 	int i, entries = 6;
 	long long statvals[entries];
-	struct sysentry *se;
-	char *first_line;
-	char *names[] = {"cpu_total", "cpu_user", "cpu_nice", "cpu_sys",
-			 "cpu_idle", "cpu_iowait"};
+	int ids[] = {SE_CPU_TOTAL, SE_CPU_USER, SE_CPU_NICE, SE_CPU_SYS,
+		     SE_CPU_IDLE, SE_CPU_IOWAIT};
 
-	/* we just need the first line */
-	f = fopen("/proc/stat", "r");
-	if (!f) {
-		fprintf(stderr, "Could not open /proc/stat\n");
+	value = read_proc_file(&proc_stat);
+	if (!value)
 		return -1;
-	}
-
-	first_line = fgets(line, 128, f);
-	fclose(f);
 
-	if (!first_line) {
+	/* we just need the first line */
+	if (strncmp(value, "cpu ", 4)) {
 		fprintf(stderr, "Could not read first line of /proc/stat\n");
 		return -1;
 	}
 
+	value += 3;
 	statvals[0] = 0;
-	value = line;
 	for (i = 1; i <= (entries - 1); i++) {
-		long long v;
-		value = strchr(value, ' ') + 1;
-		if (i == 1)
-			value++;
-		v = atoll(value);
-		statvals[i] = v;
-		statvals[0] += v;
+		statvals[i] = scan_ull(&value);
+		statvals[0] += statvals[i];
 	}
 
-	for (i = 0; i < entries; i++) {
-		se = get_sysentry(names[i]);
-		sprintf(se->value, "%lld", statvals[i]);
-	}
+	for (i = 0; i < entries; i++)
+		se_set_num(ids[i], statvals[i]);
 
-	se = get_sysentry("cpu_lbusy");
-	sprintf(se->value, "%lld", statvals[1] + statvals[3]);
+	se_set_num(SE_CPU_LBUSY, statvals[1] + statvals[3]);
 
 	return 0;
 }
@@ -719,7 +968,7 @@ void get_processor_type(struct sysentry *se, char *buf)
 {
 	char *value = "?";
 
-	if (se->value[0] == '1')
+	if (se_num(sysentry_id(se)) == 1)
 		value = "Shared";
 	else 
 		value = "Dedicated";
@@ -731,7 +980,7 @@ void get_capped_mode(struct sysentry *se, char *buf)
 {
 	char *value = "?";
 
-	if (se->value[0] == '1')
+	if (se_num(sysentry_id(se)) == 1)
 		value = "Capped";
 	else 
 		value = "Uncapped";
@@ -743,7 +992,7 @@ void get_dedicated_mode(struct sysentry *se, char *buf)
 {
 	const char *value = "Capped";
 
-	if (se->value[0] == '1')
+	if (se_num(sysentry_id(se)) == 1)
 		value = "Donating";
 
 	sprintf(buf, "%s", value);
@@ -753,43 +1002,33 @@ void get_percent_entry(struct sysentry *se, char *buf)
 {
 	float value;
 
-	value = atoi(se->value);
+	value = se_num(sysentry_id(se));
 	sprintf(buf, "%.2f", (value /100));
 }
 
 void get_phys_cpu_percentage(struct sysentry *se, char *buf)
 {
-	struct sysentry *tmp_se;
 	int entcap, active;
 
-	tmp_se = get_sysentry("DesEntCap");
-	entcap = atoi(tmp_se->value);
-
-	tmp_se = get_sysentry("partition_active_processors");
-	active = atoi(tmp_se->value);
+	entcap = se_num(SE_DESENTCAP);
+	active = se_num(SE_PARTITION_ACTIVE_PROCESSORS);
+	if (!active) {
+		sprintf(buf, SE_NOT_VALID);
+		return;
+	}
 
 	sprintf(buf, "%d", entcap/active);
 }
 
 void get_active_cpus_in_pool(struct sysentry *se, char *buf)
 {
-	struct sysentry *tmp;
-
-	tmp = get_sysentry("physical_procs_allocated_to_virtualization");
-	if (tmp) {
-		sprintf(buf, "%d", atoi(tmp->value));
-	} else {
-		tmp = get_sysentry("pool_capacity");
-		sprintf(buf, "%d", atoi(tmp->value)/100);
-	}
+	sprintf(buf, "%d",
+		(int)se_num(SE_PHYSICAL_PROCS_ALLOCATED_TO_VIRTUALIZATION));
 }
 
 void get_memory_mode(struct sysentry *se, char *buf)
 {
-	struct sysentry *tmp;
-
-	tmp = get_sysentry("entitled_memory_pool_number");
-	if (atoi(tmp->value) == 65535)
+	if (se_num(SE_ENTITLED_MEMORY_POOL_NUMBER) == 65535)
 		sprintf(buf, "Dedicated");
 	else
 		sprintf(buf, "Shared");
@@ -902,27 +1141,13 @@ void get_smt_mode(struct sysentry *se, char *buf)
 
 void get_online_cores(void)
 {
-	struct sysentry *se;
-	int *core_state;
-	int online_cores = 0;
-	int i;
-
-	core_state = calloc(cpus_in_system, sizeof(int));
-	if (!core_state) {
+	if (cpu_topology_init()) {
 		fprintf(stderr, "Failed to read online cores\n");
 		return;
 	}
 
-	for (i = 0; i < cpus_in_system; i++) {
-		core_state[i] = (get_one_smt_state(i) > 0);
-		if (core_state[i])
-			online_cores++;
-	}
-
-	se = get_sysentry("online_cores");
-	sprintf(se->value, "%d", online_cores);
-
-	free(core_state);
+	se_set_num(SE_ONLINE_CORES,
+		   topology_nr_online_cores(cpus_in_system, threads_per_cpu));
 }
 
 void get_cpu_stat(struct sysentry *se, char *buf)
@@ -930,58 +1155,95 @@ void get_cpu_stat(struct sysentry *se, char *buf)
 	float percent;
 	long long total, delta_val;
 
-	total = get_delta_value("cpu_total");
-	delta_val = get_delta_value(se->name);
+	total = get_delta_value(SE_CPU_TOTAL);
+	delta_val = get_delta_value(sysentry_id(se));
 	percent = (delta_val/(long double)total) * 100;
 	sprintf(buf, "%.2f", percent);
 }
 
-int has_cpu_topology_changed(void)
+/**
+ * update_online_cpus
+ * @brief Refresh the online cpu mask with a single read of the sysfs list
+ *
+ * @returns 1 if the online cpus changed, 0 if not, -1 on error
+ */
+static int update_online_cpus(void)
 {
-	int i, changed = 1;
-	cpu_set_t *tmp_cpuset;
-	size_t online_cpus_size = CPU_ALLOC_SIZE(threads_in_system);
+	int rc;
+
+	rc = cpu_topology_update_online();
+	if (rc == -1) {
+		fprintf(stderr, "Failed to read the online cpus\n");
+		return -1;
+	}
 
-	if (!online_cpus) {
-		online_cpus = CPU_ALLOC(threads_in_system);
-		if (!online_cpus) {
-			fprintf(stderr, "Failed to allocate memory for cpu_set\n");
+	if (topology_max_online_cpu() >= threads_in_system) {
+		/* Cpus were added to the partition */
+		if (get_cpu_info(&threads_per_cpu, &cpus_in_system,
+				 &threads_in_system)) {
+			fprintf(stderr, "Failed to capture system CPUs information\n");
 			return -1;
 		}
+	}
 
-		CPU_ZERO_S(online_cpus_size, online_cpus);
-
-		for (i = 0; i < threads_in_system; i++) {
-			if (!cpu_online(i))
-				continue;
-			CPU_SET_S(i, online_cpus_size, online_cpus);
-		}
+	return rc;
+}
 
-		return changed;
-	}
+/**
+ * update_cpu_sysfs_fds
+ * @brief Open or close the sysfs files of the cpus that changed state
+ *
+ * Cpus that stayed online keep their descriptors and previous sample.
+ * The descriptors are compared with the online mask rather than relying
+ * on update_online_cpus(), as the SMT code refreshes the same mask.
+ *
+ * @param hotplug true if the cpus opened now came online while sampling
+ * @returns 1 if any descriptor was opened or closed, 0 if not, -1 on error
+ */
+static int update_cpu_sysfs_fds(bool hotplug)
+{
+	cpu_sysfs_fd *fds;
+	int cpu, changed = 0;
 
-	tmp_cpuset = CPU_ALLOC(threads_in_system);
-	if (!tmp_cpuset) {
-		fprintf(stderr, "Failed to allocate memory for cpu_set\n");
+	if (resize_cpu_sysfs_fds(topology_nr_cpus()))
 		return -1;
-	}
 
-	CPU_ZERO_S(online_cpus_size, tmp_cpuset);
+	for (cpu = 0; cpu < nr_cpu_sysfs_fds; cpu++) {
+		fds = &cpu_sysfs_fds[cpu];
 
-	for (i = 0; i < threads_in_system; i++) {
-		if (!cpu_online(i))
+		if (!topology_cpu_online(cpu)) {
+			if (fds->spurr >= 0)
+				changed = 1;
+			close_cpu_sysfs_fd(fds);
 			continue;
-		CPU_SET_S(i, online_cpus_size, tmp_cpuset);
-	}
+		}
 
-	changed = CPU_EQUAL_S(online_cpus_size, online_cpus, tmp_cpuset);
+		if (fds->spurr >= 0)
+			continue;
 
-	CPU_FREE(online_cpus);
-	online_cpus = tmp_cpuset;
+		changed = 1;
+
+		if (open_cpu_sysfs_fd(fds)) {
+			/* Went offline again since the mask was read */
+			if (!cpu_online(cpu))
+				continue;
+			return -1;
+		}
+
+		fds->hotplugged = hotplug;
+	}
 
 	return changed;
 }
 
+static int assign_cpu_sysfs_fds(void)
+{
+	if (update_online_cpus() == -1)
+		return -1;
+
+	return update_cpu_sysfs_fds(false) == -1 ? -1 : 0;
+}
+
 void init_sysinfo(void)
 {
 	int rc = 0;
@@ -1009,53 +1271,246 @@ void init_sysinfo(void)
 		exit(-1);
 	}
 
-	rc = assign_cpu_sysfs_fds(threads_in_system);
+	rc = assign_cpu_sysfs_fds();
 	if (rc)
 		exit(rc);
 }
 
-void init_sysdata(void)
+/*
+ * Recordings start with a header naming the recorded entries, followed by
+ * one record per sample: a type byte, a bitmap of the entries present and
+ * a zigzag varint per present entry. Key records hold the values, delta
+ * records the differences to the previous record of the same run.
+ */
+#define RECORD_MAGIC	"LPARSTAT"
+#define RECORD_VERSION	1
+#define RECORD_KEY	'K'
+#define RECORD_DELTA	'D'
+#define RECORD_BITMAP_SZ(nr)	(((nr) + 7) / 8)
+#define RECORD_MAX_SZ	(1 + RECORD_BITMAP_SZ(SE_MAX) + SE_MAX * 10)
+
+static const char *record_file;
+static int record_fd = -1;
+static bool record_key = true;
+static long long record_base[SE_MAX];
+
+static int put_varint(unsigned char *buf, unsigned long long value)
 {
-	int rc = 0;
+	int len = 0;
 
-	get_time();
-	parse_lparcfg();
-	parse_proc_stat();
-	parse_proc_ints();
-	get_time_base();
+	while (value >= 0x80) {
+		buf[len++] = value | 0x80;
+		value >>= 7;
+	}
+	buf[len++] = value;
 
-	/* Skip reading spurr, purr, idle_{purr,spurr} and calculating
-	 * effective frequency for default option */
-	if (!o_scaled)
+	return len;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, p, len);
+		if (rc == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		p += rc;
+		len -= rc;
+	}
+
+	return 0;
+}
+
+/* Header identifying the format and the entries of this lparstat */
+static unsigned char *build_record_header(size_t *len)
+{
+	unsigned char *hdr;
+	size_t size;
+	int id;
+
+	size = strlen(RECORD_MAGIC) + 1 + 10;
+	for (id = 0; id < SE_MAX; id++)
+		size += strlen(system_data[id].name) + 1;
+
+	hdr = malloc(size);
+	if (!hdr)
+		return NULL;
+
+	memcpy(hdr, RECORD_MAGIC, strlen(RECORD_MAGIC));
+	*len = strlen(RECORD_MAGIC);
+	hdr[(*len)++] = RECORD_VERSION;
+	*len += put_varint(hdr + *len, SE_MAX);
+
+	for (id = 0; id < SE_MAX; id++) {
+		strcpy((char *)hdr + *len, system_data[id].name);
+		*len += strlen(system_data[id].name) + 1;
+	}
+
+	return hdr;
+}
+
+/**
+ * open_record_file
+ * @brief Open a recording for appending, writing its header if it is new
+ *
+ * @returns 0 on success, -1 on error
+ */
+static int open_record_file(void)
+{
+	unsigned char *hdr, *old_hdr;
+	struct stat sbuf;
+	size_t len;
+	int rc = -1;
+
+	hdr = build_record_header(&len);
+	if (!hdr) {
+		fprintf(stderr, "Failed to allocate memory for the recording header\n");
+		return -1;
+	}
+
+	record_fd = open(record_file, O_RDWR | O_CREAT | O_APPEND, 0644);
+	if (record_fd == -1 || fstat(record_fd, &sbuf)) {
+		fprintf(stderr, "Could not open %s: %s\n", record_file,
+			strerror(errno));
+		goto out;
+	}
+
+	if (sbuf.st_size == 0) {
+		if (write_all(record_fd, hdr, len)) {
+			fprintf(stderr, "Failed to write to %s: %s\n",
+				record_file, strerror(errno));
+			goto out;
+		}
+	} else {
+		/* Only append to recordings with the same entries */
+		old_hdr = malloc(len);
+		if (!old_hdr || pread(record_fd, old_hdr, len, 0) != len ||
+		    memcmp(old_hdr, hdr, len)) {
+			fprintf(stderr, "%s is not a recording of this version of lparstat\n",
+				record_file);
+			free(old_hdr);
+			goto out;
+		}
+		free(old_hdr);
+	}
+
+	rc = 0;
+out:
+	if (rc && record_fd != -1) {
+		close(record_fd);
+		record_fd = -1;
+	}
+	free(hdr);
+	return rc;
+}
+
+/**
+ * record_sample
+ * @brief Append the numeric values of the current sample to the recording
+ *
+ * The first record of each run is a key record. A failed write stops
+ * the recording but not the report.
+ */
+static void record_sample(void)
+{
+	unsigned char buf[RECORD_MAX_SZ];
+	unsigned char *bitmap = buf + 1;
+	size_t len = 1 + RECORD_BITMAP_SZ(SE_MAX);
+	long long value, delta;
+	int id;
+
+	memset(buf, 0, len);
+	if (record_key) {
+		buf[0] = RECORD_KEY;
+		memset(record_base, 0, sizeof(record_base));
+	} else {
+		buf[0] = RECORD_DELTA;
+	}
+
+	for (id = 0; id < SE_MAX; id++) {
+		if (!se_valid(id))
+			continue;
+
+		value = se_num(id);
+		delta = value - record_base[id];
+		record_base[id] = value;
+
+		bitmap[id / 8] |= 1 << (id % 8);
+		len += put_varint(buf + len, ((unsigned long long)delta << 1) ^
+					     (unsigned long long)(delta >> 63));
+	}
+
+	if (write_all(record_fd, buf, len)) {
+		fprintf(stderr, "Failed to write to %s: %s, recording stopped\n",
+			record_file, strerror(errno));
+		close(record_fd);
+		record_fd = -1;
 		return;
+	}
 
-	rc = has_cpu_topology_changed();
-	if (!rc)
-		goto cpu_hotplug_restart;
+	record_key = false;
+}
 
-	rc = parse_sysfs_values();
+static void init_scaled_sysdata(void)
+{
+	int rc;
+
+	if (update_online_cpus() == -1)
+		exit(-1);
+
+	rc = update_cpu_sysfs_fds(true);
 	if (rc == -1)
 		exit(rc);
-	else if (rc)
-		goto cpu_hotplug_restart;
+
+	if (rc)
+		get_online_cores();
+
+	rc = parse_sysfs_values();
+	if (rc)
+		exit(rc);
 
 	get_effective_frequency();
+}
+
+void init_sysdata(void)
+{
+	get_time();
+	parse_lparcfg();
+	parse_proc_stat();
+	parse_proc_ints();
 
-	return;
+	/* The timebase does not change, read /proc/cpuinfo only once */
+	if (!se_valid(SE_TIMEBASE))
+		get_time_base();
 
-cpu_hotplug_restart:
-	close_cpu_sysfs_fds(threads_in_system);
-	init_sysinfo();
+	/* Skip reading spurr, purr, idle_{purr,spurr} and calculating
+	 * effective frequency for default option */
+	if (o_scaled)
+		init_scaled_sysdata();
+
+	if (record_fd != -1)
+		record_sample();
+}
+
+/* Make the current sample the previous one */
+static void next_sample(void)
+{
+	struct sysdata_sample *sample = old_sample;
+
+	old_sample = cur_sample;
+	cur_sample = sample;
+	memset(cur_sample->valid, 0, sizeof(cur_sample->valid));
 }
 
 void update_sysdata(void)
 {
-	struct sysentry *se = &system_data[0];
-	while (se->name[0] != '\0') {
-		memcpy(se->old_value, se->value, SYSDATA_VALUE_SZ);
-		se++;
-	}
-	
+	next_sample();
 	init_sysdata();
 }
 
@@ -1067,7 +1522,7 @@ int print_iflag_data()
 	int i = 0;
 
 	while (iflag_entries[i] != NULL) {
-		get_sysdata(iflag_entries[i], &descr, value);
+		get_sysdata_by_name(iflag_entries[i], &descr, value);
 #ifndef DEBUG
 		if (strcmp(value, SE_NOT_VALID) && strcmp(value, SE_NOT_FOUND))
 #endif
@@ -1087,112 +1542,720 @@ void print_system_configuration(void)
 	char value[32];
 
 	memset(buf, 0, 128);
-	get_sysdata("shared_processor_mode", &descr, value);
+	get_sysdata(SE_SHARED_PROCESSOR_MODE, &descr, value);
 	offset = sprintf(buf, "type=%s ", value);
 	sprintf(type, "%s", value);
 	if (!strcmp(value, "Dedicated"))
-		get_sysdata("DedDonMode", &descr, value);
+		get_sysdata(SE_DEDDONMODE, &descr, value);
 	else
-		get_sysdata("capped", &descr, value);
+		get_sysdata(SE_CAPPED, &descr, value);
 	offset += sprintf(buf + offset, "mode=%s ", value);
-	get_sysdata("smt_state", &descr, value);
+	get_sysdata(SE_SMT_STATE, &descr, value);
 	offset += sprintf(buf + offset, "smt=%s ", value);
 	if (!strcmp(value, "Off"))
 		smt = 1;
 	else
 		smt = atoi(value);
-	get_sysdata("partition_active_processors", &descr, value);
+	get_sysdata(SE_PARTITION_ACTIVE_PROCESSORS, &descr, value);
 	active_proc = atoi(value);
 	if (o_legacy)
 		offset += sprintf(buf + offset, "lcpu=%d ", active_proc*smt);
 	else
 		offset += sprintf(buf + offset, "lcpu=%s ", value);
-	get_sysdata("MemTotal", &descr, value);
+	get_sysdata(SE_MEMTOTAL, &descr, value);
 	offset += sprintf(buf + offset, "mem=%s ", value);
-	get_sysdata("active_cpus_in_pool", &descr, value);
+	get_sysdata(SE_ACTIVE_CPUS_IN_POOL, &descr, value);
 	if (o_legacy) {
 		if (strcmp(type, "Dedicated"))
 			offset += sprintf(buf + offset, "psize=%s ", value);
 	} else {
 		offset += sprintf(buf + offset, "cpus=%s ", value);
 	}
-	get_sysdata("DesEntCap", &descr, value);
+	get_sysdata(SE_DESENTCAP, &descr, value);
 	offset += sprintf(buf + offset, "ent=%s ", value);
 
 	fprintf(stdout, "\nSystem Configuration\n%s\n\n", buf);
 }
 
-void print_default_output(int interval, int count)
+static const char *default_fmt = "%5s %5s %5s %8s %8s %5s %5s %5s %5s %5s\n";
+
+static void print_default_header(void)
+{
+	fprintf(stdout, default_fmt, "\%user", "\%sys", "\%wait", "\%idle",
+		"physc", "\%entc", "lbusy", "app", "vcsw", "phint");
+	fprintf(stdout, default_fmt, "-----", "-----", "-----", "-----",
+		"-----", "-----", "-----", "-----", "-----", "-----");
+}
+
+static void print_default_report(void)
 {
-	char *fmt = "%5s %5s %5s %8s %8s %5s %5s %5s %5s %5s\n";
 	char *descr;
 	char user[32], sys[32], wait[32], idle[32], physc[32], entc[32];
 	char lbusy[32], app[32], vcsw[32], phint[32];
 
-	print_system_configuration();
+	get_sysdata(SE_CPU_USER, &descr, user);
+	get_sysdata(SE_CPU_SYS, &descr, sys);
+	get_sysdata(SE_CPU_IOWAIT, &descr, wait);
+	get_sysdata(SE_CPU_IDLE, &descr, idle);
+	get_sysdata(SE_CPU_LBUSY, &descr, lbusy);
+	get_sysdata(SE_DISPATCHES, &descr, vcsw);
+	get_sysdata(SE_PHYSC, &descr, physc);
+	get_sysdata(SE_PER_ENTC, &descr, entc);
+	get_sysdata(SE_PHINT, &descr, phint);
+	get_sysdata(SE_APP, &descr, app);
+
+	fprintf(stdout, default_fmt, user, sys, wait, idle, physc, entc,
+		lbusy, app, vcsw, phint);
+}
+
+void print_default_output(long long interval, int count)
+{
+	struct interval_timer timer;
 
-	fprintf(stdout, fmt, "\%user", "\%sys", "\%wait", "\%idle", "physc",
-		"\%entc", "lbusy", "app", "vcsw", "phint");
-	fprintf(stdout, fmt, "-----", "-----", "-----", "-----", "-----",
-		"-----", "-----", "-----", "-----", "-----");
+	print_system_configuration();
+	print_default_header();
 
+	interval_timer_start(&timer, interval);
 	do {
 		if (interval) {
-			sleep(interval);
+			interval_timer_wait(&timer);
 			update_sysdata();
 		}
 
-		get_sysdata("cpu_user", &descr, user);
-		get_sysdata("cpu_sys", &descr, sys);
-		get_sysdata("cpu_iowait", &descr, wait);
-		get_sysdata("cpu_idle", &descr, idle);
-		get_sysdata("cpu_lbusy", &descr, lbusy);
-		get_sysdata("dispatches", &descr, vcsw);
-		get_sysdata("physc", &descr, physc);
-		get_sysdata("per_entc", &descr, entc);
-		get_sysdata("phint", &descr, phint);
-		get_sysdata("app", &descr, app);
-
-		fprintf(stdout, fmt, user, sys, wait, idle, physc, entc,
-			lbusy, app, vcsw, phint);
+		print_default_report();
 		fflush(stdout);
 	} while (--count > 0);
 }
 
-void print_scaled_output(int interval, int count)
+static void print_scaled_header(void)
+{
+	fprintf(stdout, "---Actual---                 -Normalized-\n");
+	fprintf(stdout, "%%busy  %%idle   Frequency     %%busy  %%idle\n");
+	fprintf(stdout, "------ ------  ------------- ------ ------\n");
+}
+
+static void print_scaled_report(void)
 {
 	char purr[32], purr_idle[32], spurr[32], spurr_idle[32];
 	char nominal_f[32], effective_f[32];
 	double nominal_freq, effective_freq;
 	char *descr;
 
+	get_sysdata(SE_PURR_CPU_UTIL, &descr, purr);
+	get_sysdata(SE_PURR_CPU_IDLE, &descr, purr_idle);
+	get_sysdata(SE_SPURR_CPU_UTIL, &descr, spurr);
+	get_sysdata(SE_SPURR_CPU_IDLE, &descr, spurr_idle);
+	get_sysdata(SE_NOMINAL_FREQ, &descr, nominal_f);
+	get_sysdata(SE_EFFECTIVE_FREQ, &descr, effective_f);
+	nominal_freq = strtod(nominal_f, NULL);
+	effective_freq = strtod(effective_f, NULL);
+
+	fprintf(stdout, "%6s %6s %5.2fGHz[%3d%%] %6s %6s\n",
+		purr, purr_idle,
+		effective_freq/1000,
+		(int)((effective_freq/nominal_freq * 100)+ 0.44 ),
+		spurr, spurr_idle );
+}
+
+void print_scaled_output(long long interval, int count)
+{
+	struct interval_timer timer;
+
 	print_system_configuration();
+	print_scaled_header();
 
-	fprintf(stdout, "---Actual---                 -Normalized-\n");
-	fprintf(stdout, "%%busy  %%idle   Frequency     %%busy  %%idle\n");
-	fprintf(stdout, "------ ------  ------------- ------ ------\n");
+	interval_timer_start(&timer, interval);
+	do {
+		if (interval) {
+			interval_timer_wait(&timer);
+			update_sysdata();
+		}
+
+		print_scaled_report();
+		fflush(stdout);
+	} while (--count > 0);
+}
+
+struct breakdown_entry {
+	int				id;
+	struct cpu_sysfs_sample		delta;
+	double				busy;
+};
+
+static int breakdown_key(cpu_sysfs_fd *fds)
+{
+	switch (o_breakdown) {
+	case BREAKDOWN_CORE:
+		return fds->cpu / threads_per_cpu;
+	case BREAKDOWN_NODE:
+		return fds->node;
+	default:
+		return fds->cpu;
+	}
+}
+
+/* Hottest first */
+static int breakdown_cmp(const void *a, const void *b)
+{
+	const struct breakdown_entry *ea = a, *eb = b;
+
+	if (ea->busy != eb->busy)
+		return ea->busy < eb->busy ? 1 : -1;
+
+	return ea->id - eb->id;
+}
+
+/**
+ * collect_breakdown
+ * @brief Sum the per cpu deltas of the last interval by cpu, core or node
+ *
+ * @param entries array of at least nr_cpu_sysfs_fds entries
+ * @returns number of entries filled, sorted by busy percentage
+ */
+static int collect_breakdown(struct breakdown_entry *entries)
+{
+	struct breakdown_entry *e;
+	cpu_sysfs_fd *fds;
+	int i, j, key, nr = 0;
+
+	for (i = 0; i < nr_cpu_sysfs_fds; i++) {
+		fds = &cpu_sysfs_fds[i];
+		if (fds->spurr < 0)
+			continue;
+
+		key = breakdown_key(fds);
+
+		/* Threads of a core are adjacent, try the last entry first */
+		e = NULL;
+		if (nr && entries[nr - 1].id == key) {
+			e = &entries[nr - 1];
+		} else {
+			for (j = 0; j < nr; j++) {
+				if (entries[j].id == key) {
+					e = &entries[j];
+					break;
+				}
+			}
+		}
+
+		if (!e) {
+			e = &entries[nr++];
+			memset(e, 0, sizeof(*e));
+			e->id = key;
+		}
+
+		e->delta.purr += fds->cur.purr - fds->prev.purr;
+		e->delta.spurr += fds->cur.spurr - fds->prev.spurr;
+		e->delta.idle_purr += fds->cur.idle_purr - fds->prev.idle_purr;
+		e->delta.idle_spurr += fds->cur.idle_spurr - fds->prev.idle_spurr;
+	}
+
+	for (i = 0; i < nr; i++) {
+		e = &entries[i];
+
+		/* See get_cpu_util_purr() */
+		if (e->delta.idle_purr > e->delta.purr)
+			e->delta.idle_purr = e->delta.purr;
+
+		if (e->delta.purr)
+			e->busy = (double)(e->delta.purr - e->delta.idle_purr) /
+				  e->delta.purr * 100;
+	}
+
+	qsort(entries, nr, sizeof(*entries), breakdown_cmp);
+	return nr;
+}
+
+static void print_breakdown(struct breakdown_entry *entries, int nr)
+{
+	const char *level[] = { "cpu", "cpu", "core", "node" };
+	double nominal_freq, freq, purr, nbusy, nidle;
+	char label[32];
+	int i;
+
+	nominal_freq = se_num(SE_NOMINAL_FREQ);
+
+	fprintf(stdout, "        ---Actual---                 -Normalized-\n");
+	fprintf(stdout, "%-7s %%busy  %%idle   Frequency     %%busy  %%idle\n",
+		level[o_breakdown]);
+	fprintf(stdout, "------- ------ ------  ------------- ------ ------\n");
+
+	for (i = 0; i < nr; i++) {
+		purr = entries[i].delta.purr;
+		if (!purr)
+			continue;
+
+		freq = entries[i].delta.spurr / purr * nominal_freq;
+		nbusy = (entries[i].delta.spurr - entries[i].delta.idle_spurr) /
+			purr * 100;
+		nidle = entries[i].delta.idle_spurr / purr * 100;
+
+		if (entries[i].id < 0)
+			snprintf(label, sizeof(label), "%s?", level[o_breakdown]);
+		else
+			snprintf(label, sizeof(label), "%s%d",
+				 level[o_breakdown], entries[i].id);
+
+		fprintf(stdout, "%-7s %6.2f %6.2f %5.2fGHz[%3d%%] %6.2f %6.2f\n",
+			label, entries[i].busy, 100 - entries[i].busy,
+			freq / 1000, (int)((freq / nominal_freq * 100) + 0.44),
+			nbusy, nidle);
+	}
+
+	fprintf(stdout, "\n");
+}
+
+void print_breakdown_output(long long interval, int count)
+{
+	struct breakdown_entry *entries = NULL;
+	struct interval_timer timer;
+	int nr_entries = 0, nr;
+
+	print_system_configuration();
+
+	interval_timer_start(&timer, interval);
 	do {
 		if (interval) {
-			sleep(interval);
+			interval_timer_wait(&timer);
 			update_sysdata();
 		}
 
-		get_sysdata("purr_cpu_util", &descr, purr);
-		get_sysdata("purr_cpu_idle", &descr, purr_idle);
-		get_sysdata("spurr_cpu_util", &descr, spurr);
-		get_sysdata("spurr_cpu_idle", &descr, spurr_idle);
-		get_sysdata("nominal_freq", &descr, nominal_f);
-		get_sysdata("effective_freq", &descr, effective_f);
-		nominal_freq = strtod(nominal_f, NULL);
-		effective_freq = strtod(effective_f, NULL);
-
-		fprintf(stdout, "%6s %6s %5.2fGHz[%3d%%] %6s %6s\n",
-			purr, purr_idle,
-			effective_freq/1000,
-			(int)((effective_freq/nominal_freq * 100)+ 0.44 ),
-			spurr, spurr_idle );
+		/* Only reallocated if cpus were added */
+		if (nr_entries < nr_cpu_sysfs_fds) {
+			free(entries);
+			nr_entries = nr_cpu_sysfs_fds;
+			entries = calloc(nr_entries, sizeof(*entries));
+			if (!entries) {
+				fprintf(stderr, "Failed to allocate memory for per cpu statistics\n");
+				return;
+			}
+		}
+
+		nr = collect_breakdown(entries);
+		print_breakdown(entries, nr);
 		fflush(stdout);
 	} while (--count > 0);
+
+	free(entries);
+}
+
+/* JSON numbers, which excludes the hex, inf and nan accepted by strtod */
+static bool is_json_number(const char *value)
+{
+	const char *p = value;
+
+	if (*p == '-')
+		p++;
+
+	if (*p < '0' || *p > '9')
+		return false;
+
+	while (*p >= '0' && *p <= '9')
+		p++;
+
+	if (*p == '.') {
+		p++;
+		if (*p < '0' || *p > '9')
+			return false;
+
+		while (*p >= '0' && *p <= '9')
+			p++;
+	}
+
+	return *p == '\0';
+}
+
+/* Derived values computed from missing counters print as inf or nan */
+static bool is_missing_value(const char *value)
+{
+	char *end;
+	double d;
+
+	if (value[0] == '\0' || !strcmp(value, SE_NOT_VALID))
+		return true;
+
+	d = strtod(value, &end);
+	return *end == '\0' && !isfinite(d);
+}
+
+static void print_json_string(const char *str)
+{
+	putchar('"');
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\')
+			printf("\\%c", *str);
+		else if ((unsigned char)*str < 0x20)
+			printf("\\u%04x", *str);
+		else
+			putchar(*str);
+	}
+	putchar('"');
+}
+
+static void print_csv_field(const char *str)
+{
+	if (!strpbrk(str, ",\"\n")) {
+		fputs(str, stdout);
+		return;
+	}
+
+	putchar('"');
+	for (; *str != '\0'; str++) {
+		if (*str == '"')
+			putchar('"');
+		putchar(*str);
+	}
+	putchar('"');
+}
+
+static bool skip_structured_entry(int id)
+{
+	return !o_scaled && (system_data[id].flags & SE_SCALED);
+}
+
+static void print_structured_header(void)
+{
+	int id;
+
+	if (o_format != OUTPUT_CSV)
+		return;
+
+	fputs("timestamp", stdout);
+	for (id = 0; id < SE_MAX; id++) {
+		if (skip_structured_entry(id))
+			continue;
+
+		putchar(',');
+		print_csv_field(system_data[id].name);
+	}
+	putchar('\n');
+}
+
+/**
+ * print_structured_sample
+ * @brief Print every entry of the current sample as one JSON object or
+ * CSV row
+ *
+ * Entries that have no value are printed as null in JSON and as empty
+ * fields in CSV. The timestamp is the CLOCK_BOOTTIME sample time.
+ */
+static void print_structured_sample(void)
+{
+	char value[SYSDATA_VALUE_SZ];
+	long long now = se_num(SE_TIME);
+	char *descr;
+	int id;
+
+	if (o_format == OUTPUT_JSON)
+		printf("{\"timestamp\":%lld.%09lld", now / NSEC_PER_SEC,
+		       now % NSEC_PER_SEC);
+	else
+		printf("%lld.%09lld", now / NSEC_PER_SEC, now % NSEC_PER_SEC);
+
+	for (id = 0; id < SE_MAX; id++) {
+		bool missing;
+
+		if (skip_structured_entry(id))
+			continue;
+
+		value[0] = '\0';
+		get_sysdata(id, &descr, value);
+		missing = is_missing_value(value);
+
+		putchar(',');
+		if (o_format == OUTPUT_CSV) {
+			if (!missing)
+				print_csv_field(value);
+			continue;
+		}
+
+		print_json_string(system_data[id].name);
+		putchar(':');
+		if (missing)
+			fputs("null", stdout);
+		else if (is_json_number(value))
+			fputs(value, stdout);
+		else
+			print_json_string(value);
+	}
+
+	if (o_format == OUTPUT_JSON)
+		putchar('}');
+	putchar('\n');
+}
+
+void print_structured_output(long long interval, int count)
+{
+	struct interval_timer timer;
+
+	print_structured_header();
+
+	interval_timer_start(&timer, interval);
+	do {
+		if (interval) {
+			interval_timer_wait(&timer);
+			update_sysdata();
+		}
+
+		print_structured_sample();
+		fflush(stdout);
+	} while (--count > 0);
+}
+
+struct replay {
+	FILE		*f;
+	int		nr_entries;
+	int		*ids;		/* sysentry of each recorded entry, or -1 */
+	long long	*values;
+	bool		*present;	/* in the last record read */
+	unsigned char	*bitmap;
+	bool		key;		/* last record read is a key record */
+	int		time_idx;	/* recorded entry of the sample time */
+};
+
+static int get_varint(FILE *f, unsigned long long *value)
+{
+	int c, shift = 0;
+
+	*value = 0;
+	do {
+		c = getc(f);
+		if (c == EOF || shift > 63)
+			return -1;
+
+		*value |= (unsigned long long)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	return 0;
+}
+
+static int read_record_header(struct replay *r)
+{
+	char magic[sizeof(RECORD_MAGIC) - 1];
+	char name[SYSDATA_NAME_SZ];
+	unsigned long long nr;
+	struct sysentry *se;
+	int i, j, c;
+
+	if (fread(magic, sizeof(magic), 1, r->f) != 1 ||
+	    memcmp(magic, RECORD_MAGIC, sizeof(magic)) ||
+	    getc(r->f) != RECORD_VERSION || get_varint(r->f, &nr) ||
+	    nr > INT_MAX / 8)
+		return -1;
+
+	r->nr_entries = nr;
+	r->time_idx = -1;
+	r->ids = calloc(nr, sizeof(*r->ids));
+	r->values = calloc(nr, sizeof(*r->values));
+	r->present = calloc(nr, sizeof(*r->present));
+	r->bitmap = malloc(RECORD_BITMAP_SZ(nr));
+	if (!r->ids || !r->values || !r->present || !r->bitmap)
+		return -1;
+
+	for (i = 0; i < r->nr_entries; i++) {
+		for (j = 0; (c = getc(r->f)) > 0; j++) {
+			if (j < SYSDATA_NAME_SZ - 1)
+				name[j] = c;
+		}
+
+		if (c == EOF)
+			return -1;
+
+		name[j < SYSDATA_NAME_SZ ? j : SYSDATA_NAME_SZ - 1] = '\0';
+
+		/* Entries unknown to this lparstat are skipped */
+		se = get_sysentry(name);
+		r->ids[i] = se ? sysentry_id(se) : -1;
+		if (r->ids[i] == SE_TIME)
+			r->time_idx = i;
+	}
+
+	return 0;
+}
+
+/**
+ * read_record
+ * @brief Decode the next record of a recording
+ *
+ * @returns 1 if a record was read, 0 at the end of the recording, -1 if
+ * the recording is corrupt
+ */
+static int read_record(struct replay *r)
+{
+	unsigned long long delta;
+	int i, type;
+
+	type = getc(r->f);
+	if (type == EOF)
+		return 0;
+
+	if (type != RECORD_KEY && type != RECORD_DELTA)
+		return -1;
+
+	/* A record cut short by the recorder being killed ends the replay */
+	if (fread(r->bitmap, RECORD_BITMAP_SZ(r->nr_entries), 1, r->f) != 1)
+		return 0;
+
+	r->key = type == RECORD_KEY;
+	if (r->key)
+		memset(r->values, 0, r->nr_entries * sizeof(*r->values));
+
+	for (i = 0; i < r->nr_entries; i++) {
+		r->present[i] = r->bitmap[i / 8] & (1 << (i % 8));
+		if (!r->present[i])
+			continue;
+
+		if (get_varint(r->f, &delta))
+			return 0;
+
+		r->values[i] += (long long)(delta >> 1) ^ -(long long)(delta & 1);
+	}
+
+	return 1;
+}
+
+static void load_record(struct replay *r)
+{
+	int i;
+
+	for (i = 0; i < r->nr_entries; i++) {
+		if (r->present[i] && r->ids[i] >= 0)
+			se_set_num(r->ids[i], r->values[i]);
+	}
+
+	if (o_scaled)
+		get_effective_frequency();
+}
+
+/* Whether the last record read holds the SPURR based entries of -E */
+static bool record_has_scaled(struct replay *r)
+{
+	static const int scaled_ids[] = { SE_SPURR, SE_IDLE_PURR,
+					  SE_IDLE_SPURR, SE_NOMINAL_FREQ };
+	bool found;
+	int i, j;
+
+	for (j = 0; j < sizeof(scaled_ids) / sizeof(scaled_ids[0]); j++) {
+		found = false;
+		for (i = 0; i < r->nr_entries; i++) {
+			if (r->ids[i] == scaled_ids[j] && r->present[i])
+				found = true;
+		}
+
+		if (!found)
+			return false;
+	}
+
+	return true;
+}
+
+static void print_replay_header(void)
+{
+	if (o_format != OUTPUT_TEXT)
+		print_structured_header();
+	else if (o_scaled)
+		print_scaled_header();
+	else
+		print_default_header();
+}
+
+static void print_replay_report(void)
+{
+	if (o_format != OUTPUT_TEXT)
+		print_structured_sample();
+	else if (o_scaled)
+		print_scaled_report();
+	else
+		print_default_report();
+}
+
+/**
+ * replay_recording
+ * @brief Report on a recording made with --record
+ *
+ * Records are reported at the given interval, or at the recorded one if
+ * none is given, by skipping the records closer than the interval to the
+ * last one reported. The first record of each recording run only
+ * provides the starting point of the next report.
+ *
+ * @param file recording to replay
+ * @param interval interval between reports in milliseconds, or 0
+ * @param count number of reports, or 0 for the whole recording
+ * @returns 0 on success, 1 on error
+ */
+static int replay_recording(const char *file, long long interval, int count)
+{
+	struct replay r = { 0 };
+	long long now, last = 0;
+	int rc, reports = 0;
+
+	r.f = fopen(file, "r");
+	if (!r.f) {
+		fprintf(stderr, "Could not open %s: %s\n", file, strerror(errno));
+		return 1;
+	}
+
+	replaying = true;
+
+	rc = read_record_header(&r);
+	if (rc) {
+		fprintf(stderr, "%s is not an lparstat recording\n", file);
+		goto out;
+	}
+
+	rc = read_record(&r);
+	if (rc > 0 && o_scaled && !record_has_scaled(&r)) {
+		fprintf(stderr, "%s was not recorded with -E\n", file);
+		rc = -1;
+		goto out;
+	}
+
+	print_replay_header();
+
+	for (; rc > 0; rc = read_record(&r)) {
+		now = r.time_idx >= 0 ? r.values[r.time_idx] : 0;
+
+		if (r.key) {
+			/* A later run may have been recorded without -E */
+			if (o_scaled && !record_has_scaled(&r)) {
+				fprintf(stderr, "%s: run recorded without -E, replay stopped\n",
+					file);
+				rc = -1;
+				break;
+			}
+
+			next_sample();
+			memset(old_sample->valid, 0, sizeof(old_sample->valid));
+			load_record(&r);
+			last = now;
+			continue;
+		}
+
+		if (now - last < interval * NSEC_PER_MSEC)
+			continue;
+
+		next_sample();
+		load_record(&r);
+		last = now;
+
+		print_replay_report();
+		fflush(stdout);
+
+		if (count && ++reports >= count)
+			break;
+	}
+
+	if (rc < 0)
+		fprintf(stderr, "%s: corrupt record, replay stopped\n", file);
+
+out:
+	fclose(r.f);
+	free(r.ids);
+	free(r.values);
+	free(r.present);
+	free(r.bitmap);
+	return rc < 0 ? 1 : 0;
 }
 
 static void print_security_flavor(void)
@@ -1200,7 +2263,7 @@ static void print_security_flavor(void)
 	char value[64];
 	char *descr;
 
-	get_sysdata("security_flavor", &descr, value);
+	get_sysdata(SE_SECURITY_FLAVOR, &descr, value);
 	fprintf(stdout, "%-45s: %s\n", descr, value);
 }
 
@@ -1213,8 +2276,15 @@ static void usage(void)
 	       "\t-i			Lists details on the LPAR configuration.\n"
 	       "\t-x			Print the security mode settings for the LPAR.\n"
 	       "\t-E			Print SPURR metrics.\n"
+	       "\t-b, --breakdown <level>	Print SPURR metrics per cpu, core or node,\n"
+	       "\t\t\t\thottest first.\n"
 	       "\t-l, --legacy		Print the report in legacy format.\n"
-	       "interval		The interval parameter specifies the amount of time between each report.\n"
+	       "\t-o, --output <fmt>	Print every metric as JSON lines (json) or as CSV\n"
+	       "\t\t\t\trows (csv), one per report.\n"
+	       "\t-w, --record <file>	Append the raw counters of every sample to file.\n"
+	       "\t-r, --replay <file>	Report on a recording instead of the running system.\n"
+	       "interval		The interval parameter specifies the amount of time between each report,\n"
+	       "\t\t\tin seconds. Fractions (0.5) and a ms suffix (100ms) are accepted.\n"
 	       "count			The count parameter specifies how many reports will be displayed.\n");
 }
 
@@ -1222,22 +2292,22 @@ static struct option long_opts[] = {
 	{"version",	no_argument,	NULL,	'V'},
 	{"help",	no_argument,	NULL,	'h'},
 	{"legacy",	no_argument,	NULL,	'l'},
+	{"output",	required_argument, NULL, 'o'},
+	{"breakdown",	required_argument, NULL, 'b'},
+	{"record",	required_argument, NULL, 'w'},
+	{"replay",	required_argument, NULL, 'r'},
 	{0, 0, 0, 0},
 };
 
 int main(int argc, char *argv[])
 {
-	int interval = 0, count = 0;
+	long long interval = 0;
+	char *replay_file = NULL;
+	int count = 0;
 	int c, opt_index = 0;
 	int i_option = 0;
 
-	if (get_platform() != PLATFORM_PSERIES_LPAR) {
-		fprintf(stderr, "%s: is not supported on the %s platform\n",
-							argv[0], platform_name);
-		exit(1);
-	}
-
-	while ((c = getopt_long(argc, argv, "iEVhlx",
+	while ((c = getopt_long(argc, argv, "iEVhlxo:b:w:r:",
 				long_opts, &opt_index)) != -1) {
 		switch(c) {
 			case 'i':
@@ -1249,6 +2319,39 @@ int main(int argc, char *argv[])
 			case 'E':
 				o_scaled = true;
 				break;
+			case 'b':
+				if (!strcmp(optarg, "cpu")) {
+					o_breakdown = BREAKDOWN_CPU;
+				} else if (!strcmp(optarg, "core")) {
+					o_breakdown = BREAKDOWN_CORE;
+				} else if (!strcmp(optarg, "node")) {
+					o_breakdown = BREAKDOWN_NODE;
+				} else {
+					fprintf(stderr, "Invalid breakdown level %s\n",
+						optarg);
+					usage();
+					return 1;
+				}
+				o_scaled = true;
+				break;
+			case 'o':
+				if (!strcmp(optarg, "json")) {
+					o_format = OUTPUT_JSON;
+				} else if (!strcmp(optarg, "csv")) {
+					o_format = OUTPUT_CSV;
+				} else {
+					fprintf(stderr, "Invalid output format %s\n",
+						optarg);
+					usage();
+					return 1;
+				}
+				break;
+			case 'w':
+				record_file = optarg;
+				break;
+			case 'r':
+				replay_file = optarg;
+				break;
 			case 'V':
 				printf("lparstat - %s\n", VERSION);
 				return 0;
@@ -1267,23 +2370,63 @@ int main(int argc, char *argv[])
 	}
 
 	/* see if there is an interval specified */
-	if (optind < argc)
-		interval = atoi(argv[optind++]);
+	if (optind < argc) {
+		if (parse_interval(argv[optind++], &interval)) {
+			fprintf(stderr, "Invalid interval specified\n");
+			return 1;
+		}
+	}
 
 	/* check for count specified */
 	if (optind < argc)
 		count = atoi(argv[optind++]);
 
+	if (o_breakdown != BREAKDOWN_NONE && o_format != OUTPUT_TEXT) {
+		fprintf(stderr, "-b cannot be combined with -o\n");
+		return 1;
+	}
+
+	if (replay_file) {
+		if (record_file || i_option || o_security ||
+		    o_breakdown != BREAKDOWN_NONE) {
+			fprintf(stderr, "--replay can only be combined with -E, -o and -l\n");
+			return 1;
+		}
+
+		return replay_recording(replay_file, interval, count);
+	}
+
+	if (get_platform() != PLATFORM_PSERIES_LPAR) {
+		fprintf(stderr, "%s: is not supported on the %s platform\n",
+							argv[0], platform_name);
+		exit(1);
+	}
+
+	/* A recording runs until interrupted unless given a count */
+	if (record_file && interval && !count)
+		count = INT_MAX;
+
 	init_sysinfo();
+
+	if (record_file && open_record_file())
+		return 1;
+
 	init_sysdata();
 
 	if (i_option)
 		print_iflag_data();
 	else if (o_security)
 		print_security_flavor();
-	else if (o_scaled) {
+	else if (o_breakdown != BREAKDOWN_NONE) {
+		print_breakdown_output(interval, count);
+		close_cpu_sysfs_fds();
+	} else if (o_format != OUTPUT_TEXT) {
+		print_structured_output(interval, count);
+		if (o_scaled)
+			close_cpu_sysfs_fds();
+	} else if (o_scaled) {
 		print_scaled_output(interval, count);
-		close_cpu_sysfs_fds(threads_in_system);
+		close_cpu_sysfs_fds();
 	} else {
 		print_default_output(interval, count);
 	}
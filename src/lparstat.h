@@ -25,23 +25,139 @@
 #define SYSDATA_NAME_SZ		64
 #define SYSDATA_DESCR_SZ	128
 
+#define SYSFS_PERCPU_PURR	"/sys/devices/system/cpu/cpu%d/purr"
 #define SYSFS_PERCPU_SPURR	"/sys/devices/system/cpu/cpu%d/spurr"
 #define SYSFS_PERCPU_IDLE_PURR	"/sys/devices/system/cpu/cpu%d/idle_purr"
 #define SYSFS_PERCPU_IDLE_SPURR	"/sys/devices/system/cpu/cpu%d/idle_spurr"
 
+enum sysentry_id {
+	SE_NODE_NAME,
+	SE_PARTITION_NAME,
+	SE_SERIAL_NUMBER,
+	SE_SYSTEM_TYPE,
+	SE_PARTITION_ID,
+	SE_GROUP,
+	SE_BOUNDTHRDS,
+	SE_CAPINC,
+	SE_DISWHEROTPER,
+	SE_MINENTCAP,
+	SE_MINENTCAPPERVP,
+	SE_MINPROCS,
+	SE_PARTITION_MAX_ENTITLED_CAPACITY,
+	SE_SYSTEM_POTENTIAL_PROCESSORS,
+	SE_DESENTCAP,
+	SE_DESPROCS,
+	SE_DESVARCAPWT,
+	SE_DEDDONMODE,
+	SE_PARTITION_ENTITLED_CAPACITY,
+	SE_SYSTEM_ACTIVE_PROCESSORS,
+	SE_POOL,
+	SE_POOL_CAPACITY,
+	SE_POOL_IDLE_TIME,
+	SE_BOOT_POOL_IDLE_TIME,
+	SE_POOL_NUM_PROCS,
+	SE_UNALLOCATED_CAPACITY_WEIGHT,
+	SE_CAPACITY_WEIGHT,
+	SE_CAPPED,
+	SE_UNALLOCATED_CAPACITY,
+	SE_PHYSICAL_PROCS_ALLOCATED_TO_VIRTUALIZATION,
+	SE_MAX_PROC_ENTITLED_CAPACITY,
+	SE_ENTITLED_PROC_CAPACITY_AVAILABLE,
+	SE_DISPATCHES,
+	SE_DISPATCH_DISPERSIONS,
+	SE_PURR,
+	SE_TBR,
+	SE_PARTITION_ACTIVE_PROCESSORS,
+	SE_PARTITION_POTENTIAL_PROCESSORS,
+	SE_SHARED_PROCESSOR_MODE,
+	SE_SLB_SIZE,
+	SE_MINMEM,
+	SE_DESMEM,
+	SE_MAXMEM,
+	SE_ENTITLED_MEMORY,
+	SE_MAPPED_ENTITLED_MEMORY,
+	SE_ENTITLED_MEMORY_GROUP_NUMBER,
+	SE_ENTITLED_MEMORY_POOL_NUMBER,
+	SE_ENTITLED_MEMORY_POOL_SIZE,
+	SE_ENTITLED_MEMORY_WEIGHT,
+	SE_UNALLOCATED_ENTITLED_MEMORY_WEIGHT,
+	SE_UNALLOCATED_IO_MAPPING_ENTITLEMENT,
+	SE_ENTITLED_MEMORY_LOAN_REQUEST,
+	SE_BACKING_MEMORY,
+	SE_CMO_ENABLED,
+	SE_CMO_FAULTS,
+	SE_CMO_FAULT_TIME_USEC,
+	SE_CMO_PRIMARY_PSP,
+	SE_CMO_SECONDARY_PSP,
+	SE_CMO_PAGE_SIZE,
+	SE_MEMTOTAL,
+	SE_SMT_STATE,
+	SE_ONLINE_CORES,
+	SE_CPU_TOTAL,
+	SE_CPU_USER,
+	SE_CPU_NICE,
+	SE_CPU_SYS,
+	SE_CPU_IDLE,
+	SE_CPU_IOWAIT,
+	SE_CPU_LBUSY,
+	SE_ACTIVE_CPUS_IN_POOL,
+	SE_PHYS_CPU_PERCENTAGE,
+	SE_MEMORY_MODE,
+	SE_PHYSC,
+	SE_PER_ENTC,
+	SE_APP,
+	SE_TIME,
+	SE_TIMEBASE,
+	SE_NOMINAL_FREQ,
+	SE_EFFECTIVE_FREQ,
+	SE_PHINT,
+	SE_SPURR,
+	SE_IDLE_PURR,
+	SE_IDLE_SPURR,
+	SE_PURR_CPU_UTIL,
+	SE_PURR_CPU_IDLE,
+	SE_SPURR_CPU_UTIL,
+	SE_SPURR_CPU_IDLE,
+	SE_SECURITY_FLAVOR,
+	SE_MAX
+};
+
+/* Entries whose previous value is kept, see update_sysdata() */
+#define SE_DELTA	0x01
+/* Entries only sampled for the scaled (-E) report */
+#define SE_SCALED	0x02
+/* Entries whose get callback formats numeric entries, see get_sysdata() */
+#define SE_GET_NUM	0x04
+/* Entries read from the running system rather than sampled, not recorded */
+#define SE_LIVE		0x08
+
 struct sysentry {
-	char	value[SYSDATA_VALUE_SZ];	/* value from file */
-	char	old_value[SYSDATA_VALUE_SZ];	/* previous value from file */
+	char	value[SYSDATA_VALUE_SZ];	/* value from file, if any */
+	long long num;				/* numeric value */
+	bool	valid;				/* num has been set */
+	int	flags;
 	char	name[SYSDATA_NAME_SZ];		/* internal name */
 	char	descr[SYSDATA_DESCR_SZ];	/* description of data */
 	void (*get)(struct sysentry *, char *);
 };
 
+struct cpu_sysfs_sample {
+	unsigned long long purr;
+	unsigned long long spurr;
+	unsigned long long idle_purr;
+	unsigned long long idle_spurr;
+};
+
 struct cpu_sysfs_file_desc {
 	int cpu;	/* cpu number */
+	int node;	/* NUMA node of the cpu, -1 if unknown */
+	int purr;       /* per-cpu /sys/devices/system/cpu/cpuX/purr file descriptor, only for -b */
 	int spurr;      /* per-cpu /sys/devices/system/cpu/cpuX/spurr file descriptor */
 	int idle_purr;  /* per-cpu /sys/devices/system/cpu/cpuX/idle_purr file descriptor */
 	int idle_spurr; /* per-cpu /sys/devices/system/cpu/cpuX/idle_spurr file descriptor */
+	bool hotplugged;	/* came online since the previous sample */
+	struct cpu_sysfs_sample cur;	/* per-cpu values */
+	struct cpu_sysfs_sample prev;
 };
 typedef struct cpu_sysfs_file_desc cpu_sysfs_fd;
 
@@ -65,246 +181,368 @@ extern void get_cpu_idle_purr(struct sysentry *unused_se, char *buf);
 extern void get_cpu_util_spurr(struct sysentry *unused_se, char *buf);
 extern void get_cpu_idle_spurr(struct sysentry *uunused_se, char *buf);
 
-struct sysentry system_data[] = {
+struct sysentry system_data[SE_MAX] = {
 	/* System Names */
-	{.name = "node_name",
+	[SE_NODE_NAME] = {
+	 .name = "node_name",
 	 .descr = "Node Name",
+	 .flags = SE_LIVE,
 	 .get = &get_node_name},
-	{.name = "partition_name",
+	[SE_PARTITION_NAME] = {
+	 .name = "partition_name",
 	 .descr = "Partition Name",
+	 .flags = SE_LIVE,
 	 .get = &get_partition_name},
 
 	/* lparcfg data */
-	{.name = "serial_number",
+	[SE_SERIAL_NUMBER] = {
+	 .name = "serial_number",
 	 .descr = "Serial Number"},
-	{.name = "system_type",
+	[SE_SYSTEM_TYPE] = {
+	 .name = "system_type",
 	 .descr = "System Model"},
-	{.name = "partition_id",
+	[SE_PARTITION_ID] = {
+	 .name = "partition_id",
 	 .descr = "Partition Number"},
-	{.name = "group",
+	[SE_GROUP] = {
+	 .name = "group",
 	 .descr = "Partition Group-ID"},
-	{.name = "BoundThrds",
+	[SE_BOUNDTHRDS] = {
+	 .name = "BoundThrds",
 	 .descr = "Bound Threads"},
-	{.name = "CapInc",
+	[SE_CAPINC] = {
+	 .name = "CapInc",
 	 .descr = "Capacity Increment",
+	 .flags = SE_GET_NUM,
 	 .get = &get_percent_entry},
-	{.name = "DisWheRotPer",
+	[SE_DISWHEROTPER] = {
+	 .name = "DisWheRotPer",
 	 .descr = "Dispatch Wheel Rotation Period"},
-	{.name = "MinEntCap",
+	[SE_MINENTCAP] = {
+	 .name = "MinEntCap",
 	 .descr = "Minimum Capacity",
+	 .flags = SE_GET_NUM,
 	 .get = &get_percent_entry},
-	{.name = "MinEntCapPerVP",
+	[SE_MINENTCAPPERVP] = {
+	 .name = "MinEntCapPerVP",
 	 .descr = "Minimum Entitled Capacity per Virtual Processor"},
-	{.name = "MinProcs",
+	[SE_MINPROCS] = {
+	 .name = "MinProcs",
 	 .descr = "Minimum Virtual CPUs"},
-	{.name = "partition_max_entitled_capacity",
+	[SE_PARTITION_MAX_ENTITLED_CAPACITY] = {
+	 .name = "partition_max_entitled_capacity",
 	 .descr = "Maximum Capacity",
+	 .flags = SE_GET_NUM,
 	 .get = &get_percent_entry},
-	{.name = "system_potential_processors",
+	[SE_SYSTEM_POTENTIAL_PROCESSORS] = {
+	 .name = "system_potential_processors",
 	 .descr = "Maximum System Processors"},
-	{.name = "DesEntCap",
+	[SE_DESENTCAP] = {
+	 .name = "DesEntCap",
 	 .descr = "Entitled Capacity",
+	 .flags = SE_GET_NUM,
 	 .get = &get_percent_entry},
-	{.name = "DesProcs",
+	[SE_DESPROCS] = {
+	 .name = "DesProcs",
 	 .descr = "Desired Processors"},
-	{.name = "DesVarCapWt",
+	[SE_DESVARCAPWT] = {
+	 .name = "DesVarCapWt",
 	 .descr = "Desired Variable Capacity Weight"},
-	{.name = "DedDonMode",
+	[SE_DEDDONMODE] = {
+	 .name = "DedDonMode",
 	 .descr = "Dedicated Donation Mode",
+	 .flags = SE_GET_NUM,
 	 .get = &get_dedicated_mode},
-	{.name = "partition_entitled_capacity",
+	[SE_PARTITION_ENTITLED_CAPACITY] = {
+	 .name = "partition_entitled_capacity",
 	 .descr = "Partition Entitled Capacity"},
-	{.name = "system_active_processors",
+	[SE_SYSTEM_ACTIVE_PROCESSORS] = {
+	 .name = "system_active_processors",
 	 .descr = "Active Physical CPUs in system"},
-	{.name = "pool",
+	[SE_POOL] = {
+	 .name = "pool",
 	 .descr = "Shared Pool ID"},
-	{.name = "pool_capacity",
+	[SE_POOL_CAPACITY] = {
+	 .name = "pool_capacity",
 	 .descr = "Maximum Capacity of Pool",
+	 .flags = SE_GET_NUM,
 	 .get = &get_percent_entry},
-	{.name = "pool_idle_time",
+	[SE_POOL_IDLE_TIME] = {
+	 .name = "pool_idle_time",
+	 .flags = SE_DELTA,
 	 .descr = "Shared Processor Pool Idle Time"},
-	{.name = "boot_pool_idle_time",
+	[SE_BOOT_POOL_IDLE_TIME] = {
+	 .name = "boot_pool_idle_time",
 	 .descr = "Shared Processor Pool Idle Time"},
-	{.name = "pool_num_procs",
+	[SE_POOL_NUM_PROCS] = {
+	 .name = "pool_num_procs",
 	 .descr = "Shared Processor Pool Processors"},
-	{.name = "unallocated_capacity_weight",
+	[SE_UNALLOCATED_CAPACITY_WEIGHT] = {
+	 .name = "unallocated_capacity_weight",
 	 .descr = "Unallocated Weight"},
-	{.name = "capacity_weight",
+	[SE_CAPACITY_WEIGHT] = {
+	 .name = "capacity_weight",
 	 .descr = "Entitled Capacity of Pool"},
-	{.name = "capped",
+	[SE_CAPPED] = {
+	 .name = "capped",
 	 .descr = "Mode",
+	 .flags = SE_GET_NUM,
 	 .get = &get_capped_mode},
-	{.name = "unallocated_capacity",
+	[SE_UNALLOCATED_CAPACITY] = {
+	 .name = "unallocated_capacity",
 	 .descr = "Unallocated Processor Capacity"},
-	{.name = "physical_procs_allocated_to_virtualization",
+	[SE_PHYSICAL_PROCS_ALLOCATED_TO_VIRTUALIZATION] = {
+	 .name = "physical_procs_allocated_to_virtualization",
 	 .descr = "Shared Physical CPUS in system"},
-	{.name = "max_proc_entitled_capacity",
+	[SE_MAX_PROC_ENTITLED_CAPACITY] = {
+	 .name = "max_proc_entitled_capacity",
 	 .descr = "Maximum Processor Capacity Available to Pool"},
-	{.name = "entitled_proc_capacity_available",
+	[SE_ENTITLED_PROC_CAPACITY_AVAILABLE] = {
+	 .name = "entitled_proc_capacity_available",
 	 .descr = "Entitled Capacity of Pool"},
-	{.name = "dispatches",
+	[SE_DISPATCHES] = {
+	 .name = "dispatches",
 	 .descr = "Virtual Processor Dispatch Counter"},
-	{.name = "dispatch_dispersions",
+	[SE_DISPATCH_DISPERSIONS] = {
+	 .name = "dispatch_dispersions",
 	 .descr = "Virtual Processor Dispersions"},
-	{.name = "purr",
+	[SE_PURR] = {
+	 .name = "purr",
+	 .flags = SE_DELTA,
 	 .descr = "Processor Utilization Resource Register"},
-	{.name = "tbr",
+	[SE_TBR] = {
+	 .name = "tbr",
+	 .flags = SE_DELTA,
 	 .descr = "Timebase Register"},
-	{.name = "partition_active_processors",
+	[SE_PARTITION_ACTIVE_PROCESSORS] = {
+	 .name = "partition_active_processors",
 	 .descr = "Online Virtual CPUs"},
-	{.name = "partition_potential_processors",
+	[SE_PARTITION_POTENTIAL_PROCESSORS] = {
+	 .name = "partition_potential_processors",
 	 .descr = "Maximum Virtual CPUs"},
-	{.name = "shared_processor_mode",
+	[SE_SHARED_PROCESSOR_MODE] = {
+	 .name = "shared_processor_mode",
 	 .descr = "Type",
+	 .flags = SE_GET_NUM,
 	 .get = &get_processor_type},
-	{.name = "slb_size",
+	[SE_SLB_SIZE] = {
+	 .name = "slb_size",
 	 .descr = "SLB Entries"},
-	{.name = "MinMem",
+	[SE_MINMEM] = {
+	 .name = "MinMem",
 	 .descr = "Minimum Memory"},
-	{.name = "DesMem",
+	[SE_DESMEM] = {
+	 .name = "DesMem",
 	 .descr = "Desired Memory"},
-	{.name = "MaxMem",
+	[SE_MAXMEM] = {
+	 .name = "MaxMem",
 	 .descr = "Maximum Memory"},
-	{.name = "entitled_memory",
+	[SE_ENTITLED_MEMORY] = {
+	 .name = "entitled_memory",
 	 .descr = "Total I/O Memory Entitlement"},
-	{.name = "mapped_entitled_memory",
+	[SE_MAPPED_ENTITLED_MEMORY] = {
+	 .name = "mapped_entitled_memory",
 	 .descr = "Total I/O Mapped Entitled Memory"},
-	{.name = "entitled_memory_group_number",
+	[SE_ENTITLED_MEMORY_GROUP_NUMBER] = {
+	 .name = "entitled_memory_group_number",
 	 .descr = "Memory Group ID of LPAR"},
-	{.name = "entitled_memory_pool_number",
+	[SE_ENTITLED_MEMORY_POOL_NUMBER] = {
+	 .name = "entitled_memory_pool_number",
 	 .descr = "Memory Pool ID"},
-	{.name = "entitled_memory_pool_size",
+	[SE_ENTITLED_MEMORY_POOL_SIZE] = {
+	 .name = "entitled_memory_pool_size",
 	 .descr = "Physical Memory in the Pool"},
-	{.name = "entitled_memory_weight",
+	[SE_ENTITLED_MEMORY_WEIGHT] = {
+	 .name = "entitled_memory_weight",
 	 .descr = "Variable Memory Capacity Weight"},
-	{.name = "unallocated_entitled_memory_weight",
+	[SE_UNALLOCATED_ENTITLED_MEMORY_WEIGHT] = {
+	 .name = "unallocated_entitled_memory_weight",
 	 .descr = "Unallocated Variable Memory Capacity Weight"},
-	{.name = "unallocated_io_mapping_entitlement",
+	[SE_UNALLOCATED_IO_MAPPING_ENTITLEMENT] = {
+	 .name = "unallocated_io_mapping_entitlement",
 	 .descr = "Unallocated I/O Memory Entitlement"},
-	{.name = "entitled_memory_loan_request",
+	[SE_ENTITLED_MEMORY_LOAN_REQUEST] = {
+	 .name = "entitled_memory_loan_request",
 	 .descr = "Entitled Memory Loan Request"},
-	{.name = "backing_memory",
+	[SE_BACKING_MEMORY] = {
+	 .name = "backing_memory",
 	 .descr = "Backing Memory"},
-	{.name = "cmo_enabled",
+	[SE_CMO_ENABLED] = {
+	 .name = "cmo_enabled",
 	 .descr = "Active Memory Sharing Enabled"},
-	{.name = "cmo_faults",
+	[SE_CMO_FAULTS] = {
+	 .name = "cmo_faults",
 	 .descr = "Active Memory Sharing Page Faults"},
-	{.name = "cmo_fault_time_usec",
+	[SE_CMO_FAULT_TIME_USEC] = {
+	 .name = "cmo_fault_time_usec",
 	 .descr = "Active Memory Sharing Fault Time"},
-	{.name = "cmo_primary_psp",
+	[SE_CMO_PRIMARY_PSP] = {
+	 .name = "cmo_primary_psp",
 	 .descr = "Primary VIOS Partition ID"},
-	{.name = "cmo_secondary_psp",
+	[SE_CMO_SECONDARY_PSP] = {
+	 .name = "cmo_secondary_psp",
 	 .descr = "Secondary VIOS Partition ID"},
-	{.name = "cmo_page_size",
+	[SE_CMO_PAGE_SIZE] = {
+	 .name = "cmo_page_size",
 	 .descr = "Physical Page Size"},
 
 	/* /proc/meminfo */
-	{.name = "MemTotal",
+	[SE_MEMTOTAL] = {
+	 .name = "MemTotal",
 	 .descr = "Online Memory",
+	 .flags = SE_LIVE,
 	 .get = &get_mem_total},
 
 	/* smt mode, cpu_info_helpers::__do_smt() */
-	{.name = "smt_state",
+	[SE_SMT_STATE] = {
+	 .name = "smt_state",
 	 .descr = "SMT",
+	 .flags = SE_LIVE,
 	 .get = &get_smt_mode},
 
 	/* online cores, cpu_info_helpers::get_one_smt_state() */
-	{.name = "online_cores",
+	[SE_ONLINE_CORES] = {
+	 .name = "online_cores",
+	 .flags = SE_SCALED,
 	 .descr = "Online Cores"},
 
 	/* /proc/stat */
-	{.name = "cpu_total",
+	[SE_CPU_TOTAL] = {
+	 .name = "cpu_total",
+	 .flags = SE_DELTA,
 	 .descr = "CPU Total Time"},
-	{.name = "cpu_user",
+	[SE_CPU_USER] = {
+	 .name = "cpu_user",
+	 .flags = SE_DELTA,
 	 .descr = "CPU User Time",
 	 .get = &get_cpu_stat},
-	{.name = "cpu_nice",
+	[SE_CPU_NICE] = {
+	 .name = "cpu_nice",
+	 .flags = SE_DELTA,
 	 .descr = "CPU Nice Time",
 	 .get = &get_cpu_stat},
-	{.name = "cpu_sys",
+	[SE_CPU_SYS] = {
+	 .name = "cpu_sys",
+	 .flags = SE_DELTA,
 	 .descr = "CPU System Time",
 	 .get = &get_cpu_stat},
-	{.name = "cpu_idle",
+	[SE_CPU_IDLE] = {
+	 .name = "cpu_idle",
+	 .flags = SE_DELTA,
 	 .descr = "CPU Idle Time",
 	 .get = &get_cpu_stat},
-	{.name = "cpu_iowait",
+	[SE_CPU_IOWAIT] = {
+	 .name = "cpu_iowait",
+	 .flags = SE_DELTA,
 	 .descr = "CPU I/O Wait Time",
 	 .get = &get_cpu_stat},
-	{.name = "cpu_lbusy",
+	[SE_CPU_LBUSY] = {
+	 .name = "cpu_lbusy",
+	 .flags = SE_DELTA,
 	 .descr = "Logical CPU Utilization",
 	 .get = &get_cpu_stat},
 
 	/* placeholders for derived values */
-	{.name = "active_cpus_in_pool",
+	[SE_ACTIVE_CPUS_IN_POOL] = {
+	 .name = "active_cpus_in_pool",
 	 .descr = "Active CPUs in Pool",
+	 .flags = SE_GET_NUM,
 	 .get = &get_active_cpus_in_pool},
-	{.name = "phys_cpu_percentage",
+	[SE_PHYS_CPU_PERCENTAGE] = {
+	 .name = "phys_cpu_percentage",
 	 .descr = "Physical CPU Percentage",
+	 .flags = SE_GET_NUM,
 	 .get = &get_phys_cpu_percentage},
-	{.name = "memory_mode",
+	[SE_MEMORY_MODE] = {
+	 .name = "memory_mode",
 	 .descr = "Memory Mode",
+	 .flags = SE_GET_NUM,
 	 .get = &get_memory_mode},
-	{.name = "physc",
+	[SE_PHYSC] = {
+	 .name = "physc",
 	 .descr = "Physical CPU Consumed",
 	 .get = &get_cpu_physc},
-	{.name = "per_entc",
+	[SE_PER_ENTC] = {
+	 .name = "per_entc",
 	 .descr = "Entitled CPU Consumed",
 	 .get = &get_per_entc},
-	{.name = "app",
+	[SE_APP] = {
+	 .name = "app",
 	 .descr = "Available physical CPUs in pool",
 	 .get = &get_cpu_app},
 
 	/* Time */
-	{.name = "time",
+	[SE_TIME] = {
+	 .name = "time",
+	 .flags = SE_DELTA,
 	 .descr = "Time"},
 
 	/* /proc/cpuinfo */
-	{.name = "timebase",
+	[SE_TIMEBASE] = {
+	 .name = "timebase",
 	 .descr = "Timebase"},
-	{.name = "nominal_freq",
+	[SE_NOMINAL_FREQ] = {
+	 .name = "nominal_freq",
+	 .flags = SE_SCALED,
 	 .descr = "Nominal Frequency"},
 	/* derived from nominal freq */
-	{.name = "effective_freq",
+	[SE_EFFECTIVE_FREQ] = {
+	 .name = "effective_freq",
+	 .flags = SE_SCALED,
 	 .descr = "Effective Frequency"},
 
 	/* /proc/interrupts */
-	{.name = "phint",
+	[SE_PHINT] = {
+	 .name = "phint",
 	 .descr = "Phantom Interrupts"},
 
 	/* /sys/devices/system/cpu/cpu<n>/ */
 	/* Sum of per CPU SPURR registers */
-	{.name = "spurr",
+	[SE_SPURR] = {
+	 .name = "spurr",
+	 .flags = SE_DELTA | SE_SCALED,
 	 .descr = "Scaled Processor Utilization Resource Register"},
 	/* Sum of per CPU Idle PURR Values */
-	{.name = "idle_purr",
+	[SE_IDLE_PURR] = {
+	 .name = "idle_purr",
+	 .flags = SE_DELTA | SE_SCALED,
 	 .descr = "Processor Utilization Resource Idle Values"},
 	/* Sum of per CPU Idle SPURR Values */
-	{.name = "idle_spurr",
+	[SE_IDLE_SPURR] = {
+	 .name = "idle_spurr",
+	 .flags = SE_DELTA | SE_SCALED,
 	 .descr = "Scaled Processor Utilization Resource Idle Values"},
 
 	/* Dervied from above sysfs values */
 	/* PURR Utilization */
-	{.name = "purr_cpu_util",
+	[SE_PURR_CPU_UTIL] = {
+	 .name = "purr_cpu_util",
+	 .flags = SE_SCALED,
 	 .descr = "Physical CPU consumed - PURR",
 	 .get = &get_cpu_util_purr},
 	/* PURR Idle time */
-	{.name = "purr_cpu_idle",
+	[SE_PURR_CPU_IDLE] = {
+	 .name = "purr_cpu_idle",
+	 .flags = SE_SCALED,
 	 .descr = "Idle CPU value - PURR",
 	 .get = &get_cpu_idle_purr},
 	/* SPURR Utilization */
-	{.name = "spurr_cpu_util",
+	[SE_SPURR_CPU_UTIL] = {
+	 .name = "spurr_cpu_util",
+	 .flags = SE_SCALED,
 	 .descr = "Physical CPU consumed - SPURR",
 	 .get = &get_cpu_util_spurr},
 	/* SPURR Idle time */
-	{.name = "spurr_cpu_idle",
+	[SE_SPURR_CPU_IDLE] = {
+	 .name = "spurr_cpu_idle",
+	 .flags = SE_SCALED,
 	 .descr = "Idle CPU value - SPURR",
 	 .get = &get_cpu_idle_spurr},
 
 	/* Security flavor */
-	{.name = "security_flavor",
+	[SE_SECURITY_FLAVOR] = {
+	 .name = "security_flavor",
 	 .descr = "Speculative Execution Mode"},
-
-	{.name[0] = '\0'},
 };
 
 char *iflag_entries[] = {
@@ -31,6 +31,7 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/ptrace.h>
 #include <sys/wait.h>
 #include <sys/resource.h>
@@ -47,6 +48,8 @@
 
 #include <errno.h>
 #include "cpu_info_helpers.h"
+#include "interval_timer.h"
+#include "cpu_topology.h"
 
 #define PPC64_CPU_VERSION	"1.2"
 
@@ -61,9 +64,20 @@
 #ifdef HAVE_LINUX_PERF_EVENT_H
 struct cpu_freq {
 	int offline;
-	int counter;
+	int measured;		/* freq is valid for the last interval */
+	int counter;		/* cycles */
+	struct perf_event_mmap_page *counter_page;
 	pthread_t tid;
 	double freq;
+	double weight;		/* time freq was measured over */
+	/* Counts at the previous read */
+	uint64_t cycles;
+	uint64_t time_running;
+	/* Passive measurement */
+	int purr_fd;
+	int spurr_fd;
+	uint64_t purr;
+	uint64_t spurr;
 };
 
 struct energy_freq_info {
@@ -258,8 +272,23 @@ static int is_smt_capable(void)
 	return __is_smt_capable(threads_per_cpu);
 }
 
+/* Whether the online mask of the topology can be used, see refresh_online() */
+static bool online_mask_valid;
+
+/*
+ * Read the online cpus in one go before looking at every core, rather
+ * than reading the online file of each thread.
+ */
+static void refresh_online(void)
+{
+	online_mask_valid = cpu_topology_update_online() >= 0;
+}
+
 static int get_one_smt_state(int core)
 {
+	if (online_mask_valid)
+		return topology_core_online_threads(core, threads_per_cpu);
+
 	return __get_one_smt_state(core, threads_per_cpu);
 }
 
@@ -268,6 +297,8 @@ static int get_smt_state(void)
 	int smt_state = -1;
 	int i;
 
+	refresh_online();
+
 	for (i = 0; i < cpus_in_system; i++) {
 		int cpu_state = get_one_smt_state(i);
 		if (cpu_state == 0)
@@ -284,63 +315,192 @@ static int get_smt_state(void)
 	return smt_state;
 }
 
-static int set_one_smt_state(int thread, int online_threads)
+/*
+ * Core state transitions
+ *
+ * The cores to change are described by an array of core_op, run by a
+ * bounded pool of worker threads (-j, one by default). Within a core the
+ * threads are onlined in ascending order, the primary thread first, and
+ * offlined in descending order, the primary thread last.
+ *
+ * Note that the kernel serializes cpu hotplug operations, running the
+ * transitions in parallel only overlaps the work done around them.
+ */
+#define MAX_HOTPLUG_JOBS	64
+
+static int hotplug_jobs = 1;
+
+struct core_op {
+	int core;
+	int online_threads;	/* threads left online, 0 offlines the core */
+	int failed_cpu;		/* -1 if the transition succeeded */
+	int err;		/* errno of the failure */
+};
+
+struct core_op_queue {
+	struct core_op *ops;
+	int n_ops;
+	int next;
+	int done;
+	bool progress;
+};
+
+static int set_thread_online(int cpu, int online)
 {
 	char path[SYSFS_PATH_MAX];
-	int i, rc = 0;
+	int rc;
 
-	for (i = 0; i < threads_per_cpu; i++) {
-		snprintf(path, SYSFS_PATH_MAX, SYSFS_CPUDIR"/%s", thread + i,
-			 "online");
-		if (i < online_threads)
-			rc = online_thread(path);
-		else
-			rc = offline_thread(path);
+	if (cpu_online(cpu) == online)
+		return 0;
 
-		/* The 'online' sysfs file returns EINVAL if set to the current
-		 * setting. As this is not an error, reset rc and errno to avoid
-		 * returning failure. */
-		if (rc == -1 && errno == EINVAL)
-			rc = errno = 0;
-		if (rc)
+	snprintf(path, SYSFS_PATH_MAX, SYSFS_CPUDIR"/%s", cpu, "online");
+	if (online)
+		rc = online_thread(path);
+	else
+		rc = offline_thread(path);
+
+	/* The 'online' sysfs file returns EINVAL if set to the current
+	 * setting. As this is not an error, reset rc and errno to avoid
+	 * returning failure. */
+	if (rc == -1 && errno == EINVAL)
+		rc = errno = 0;
+
+	return rc;
+}
+
+static void run_core_op(struct core_op *op)
+{
+	int cpu = op->core * threads_per_cpu;
+	int i;
+
+	op->failed_cpu = -1;
+	op->err = 0;
+
+	for (i = 0; i < op->online_threads; i++) {
+		if (set_thread_online(cpu + i, 1))
+			goto failed;
+	}
+
+	for (i = threads_per_cpu - 1; i >= op->online_threads; i--) {
+		if (set_thread_online(cpu + i, 0))
+			goto failed;
+	}
+
+	return;
+
+failed:
+	op->failed_cpu = cpu + i;
+	op->err = errno;
+}
+
+static void *core_op_worker(void *arg)
+{
+	struct core_op_queue *queue = arg;
+	int i, done;
+
+	while ((i = __sync_fetch_and_add(&queue->next, 1)) < queue->n_ops) {
+		run_core_op(&queue->ops[i]);
+
+		done = __sync_add_and_fetch(&queue->done, 1);
+		if (queue->progress)
+			fprintf(stderr, "\r%d/%d cores", done, queue->n_ops);
+	}
+
+	return NULL;
+}
+
+/*
+ * Run the core transitions and report the failed ones.
+ * Return the number of cores that could not be set.
+ */
+static int run_core_ops(struct core_op *ops, int n_ops)
+{
+	struct core_op_queue queue = {
+		.ops = ops,
+		.n_ops = n_ops,
+	};
+	pthread_t tids[MAX_HOTPLUG_JOBS];
+	int i, jobs, started = 0, failed = 0;
+
+	if (!n_ops)
+		return 0;
+
+	queue.progress = n_ops > 1 && isatty(STDERR_FILENO);
+
+	jobs = MIN(hotplug_jobs, n_ops);
+	for (i = 1; i < jobs; i++) {
+		if (pthread_create(&tids[started], NULL, core_op_worker,
+				   &queue))
 			break;
+		started++;
 	}
 
-	return rc;
+	/* The calling thread takes its share of the work */
+	core_op_worker(&queue);
+
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+
+	if (queue.progress)
+		fprintf(stderr, "\n");
+
+	for (i = 0; i < n_ops; i++) {
+		struct core_op *op = &ops[i];
+
+		if (op->failed_cpu == -1)
+			continue;
+
+		failed++;
+		if (op->online_threads)
+			fprintf(stderr, "Unable to set %d threads online on "
+				"core %d: cpu%d: %s\n", op->online_threads,
+				op->core, op->failed_cpu, strerror(op->err));
+		else
+			fprintf(stderr, "Unable to take core %d offline: "
+				"cpu%d: %s\n", op->core, op->failed_cpu,
+				strerror(op->err));
+	}
+
+	return failed;
 }
 
 static int set_smt_state(int smt_state)
 {
-	int i, j, rc = 0;
-	int error = 0;
+	struct core_op *ops;
+	int i, j, n_ops = 0;
+	int failed;
 
 	if (!sysattr_is_writeable("online")) {
 		perror("Cannot set smt state");
 		return -1;
 	}
 
-	for (i = 0; i < threads_in_system; i += threads_per_cpu) {
+	ops = calloc(cpus_in_system, sizeof(*ops));
+	if (!ops)
+		return -ENOMEM;
+
+	for (i = 0; i < cpus_in_system; i++) {
 		/* Online means any thread on this core running, so check all
 		 * threads in the core, not just the first. */
 		for (j = 0; j < threads_per_cpu; j++) {
-			if (!cpu_online(i + j))
+			if (!cpu_online(i * threads_per_cpu + j))
 				continue;
 
-			rc = set_one_smt_state(i, smt_state);
-			/* Record an error, but do not check result: if we
-			 * have failed to set this core, keep trying
-			 * subsequent ones. */
-			if (rc)
-				error = 1;
+			ops[n_ops].core = i;
+			ops[n_ops].online_threads = smt_state;
+			n_ops++;
 			break;
 		}
 	}
 
-	if (error) {
+	failed = run_core_ops(ops, n_ops);
+	free(ops);
+
+	if (failed) {
 		fprintf(stderr, "One or more cpus could not be on/offlined\n");
 		return -1;
 	}
-	return rc;
+	return 0;
 }
 
 static int is_dscr_capable(void)
@@ -624,10 +784,35 @@ static int do_run_mode(char *run_mode)
 
 #ifdef HAVE_LINUX_PERF_EVENT_H
 
+static struct perf_event_mmap_page *map_counter(int fd)
+{
+	void *page;
+
+	page = mmap(NULL, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fd, 0);
+	return page == MAP_FAILED ? NULL : page;
+}
+
+static void close_counters(struct cpu_freq *cpu_freq)
+{
+	long page_size = sysconf(_SC_PAGESIZE);
+
+	if (cpu_freq->counter_page)
+		munmap(cpu_freq->counter_page, page_size);
+	if (cpu_freq->counter >= 0)
+		close(cpu_freq->counter);
+
+	cpu_freq->counter_page = NULL;
+	cpu_freq->counter = -1;
+}
+
+/*
+ * Each online cpu gets a cycles counter. A cpu whose counter cannot be
+ * opened is left out of the measurement rather than failing it.
+ */
 static int setup_counters(struct cpu_freq *cpu_freqs, int max_thread)
 {
-	int i;
 	struct perf_event_attr attr;
+	int i, nr_counted = 0;
 
 	memset(&attr, 0, sizeof(attr));
 	attr.type = PERF_TYPE_HARDWARE;
@@ -635,10 +820,12 @@ static int setup_counters(struct cpu_freq *cpu_freqs, int max_thread)
 	attr.disabled = 1;
 	attr.size = sizeof(attr);
 
-	/* Record how long the event ran for */
-	attr.read_format |= PERF_FORMAT_TOTAL_TIME_RUNNING;
+	/* Read the count along with how long it ran for */
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_RUNNING;
 
 	for (i = 0; i < max_thread; i++) {
+		cpu_freqs[i].counter = -1;
+
 		if (!cpu_online(i)) {
 			cpu_freqs[i].offline = 1;
 			continue;
@@ -648,14 +835,28 @@ static int setup_counters(struct cpu_freq *cpu_freqs, int max_thread)
 					       -1, i, -1, 0);
 
 		if (cpu_freqs[i].counter < 0) {
-			if (errno == ENOSYS)
+			if (errno == ENOSYS) {
 				fprintf(stderr, "frequency determination "
 					"not supported with this kernel.\n");
-			else
-				perror("Could not initialize performance "
-				       "counters");
-			return -1;
+				return -1;
+			}
+
+			fprintf(stderr, "Could not initialize performance "
+				"counters of cpu %d: %s\n", i,
+				strerror(errno));
+			cpu_freqs[i].offline = 1;
+			continue;
 		}
+
+		/* Fall back to read() if the user page can't be mapped */
+		cpu_freqs[i].counter_page = map_counter(cpu_freqs[i].counter);
+
+		nr_counted++;
+	}
+
+	if (!nr_counted) {
+		fprintf(stderr, "No performance counters could be set up\n");
+		return -1;
 	}
 
 	return 0;
@@ -690,29 +891,94 @@ struct read_format {
 	uint64_t time_running;
 };
 
-static void read_counters(struct cpu_freq *cpu_freqs, int max_thread)
+/*
+ * Once a counter is disabled, its user page holds the final count and run
+ * time. The page is only usable while index is 0, otherwise the count is
+ * still live in a PMC of another cpu, and once it covers the whole
+ * measurement, as not every PMU refreshes it when the counter stops.
+ */
+static int read_counter_page(struct perf_event_mmap_page *page,
+			     uint64_t min_enabled, uint64_t *value,
+			     uint64_t *time_running)
+{
+	uint32_t seq;
+
+	if (!page)
+		return -1;
+
+	do {
+		seq = page->lock;
+		__sync_synchronize();
+
+		if (page->index || page->time_enabled < min_enabled)
+			return -1;
+
+		*value = page->offset;
+		*time_running = page->time_running;
+
+		__sync_synchronize();
+	} while (page->lock != seq);
+
+	return 0;
+}
+
+static int read_counter(struct cpu_freq *cpu_freq, uint64_t min_enabled,
+			uint64_t *cycles, uint64_t *time_running)
 {
-	int i;
 	struct read_format vals;
+	ssize_t res;
 
-	for (i = 0; i < max_thread; i++) {
-		size_t res;
+	if (!read_counter_page(cpu_freq->counter_page, min_enabled, cycles,
+			       time_running))
+		return 0;
 
-		if (cpu_freqs[i].offline)
+	res = read(cpu_freq->counter, &vals, sizeof(vals));
+	if (res < (ssize_t)sizeof(vals))
+		return -1;
+
+	*time_running = vals.time_running;
+	*cycles = vals.value;
+
+	return 0;
+}
+
+/* Compute the frequency of each cpu over the interval since the last read */
+static void read_counters(struct cpu_freq *cpu_freqs, int max_thread,
+			  uint64_t min_enabled)
+{
+	uint64_t cycles, time_running;
+	struct cpu_freq *cpu_freq;
+	int i;
+
+	for (i = 0; i < max_thread; i++) {
+		cpu_freq = &cpu_freqs[i];
+		if (cpu_freq->offline)
 			continue;
 
-		res = read(cpu_freqs[i].counter, &vals, sizeof(vals));
-		assert(res == sizeof(vals));
+		cpu_freq->measured = 0;
 
-		/* Warn if we don't get at least 0.1s of time on the CPU */
-		if (vals.time_running < 100000000) {
-			fprintf(stderr, "Measurement interval was too small, is someone running perf?\n");
-			exit(1);
+		if (read_counter(cpu_freq, min_enabled, &cycles,
+				 &time_running)) {
+			fprintf(stderr, "Could not read the counters of "
+				"cpu %d\n", i);
+			cpu_freq->offline = 1;
+			close_counters(cpu_freq);
+			continue;
 		}
 
-		cpu_freqs[i].freq = 1.0 * vals.value / vals.time_running;
+		if (time_running - cpu_freq->time_running < 100000000) {
+			/* We need at least 0.1s of time on the CPU */
+			fprintf(stderr, "Measurement interval was too small "
+				"on cpu %d, is someone running perf?\n", i);
+		} else {
+			cpu_freq->weight = time_running - cpu_freq->time_running;
+			cpu_freq->freq = (cycles - cpu_freq->cycles) /
+					 cpu_freq->weight;
+			cpu_freq->measured = 1;
+		}
 
-		close(cpu_freqs[i].counter);
+		cpu_freq->cycles = cycles;
+		cpu_freq->time_running = time_running;
 	}
 }
 
@@ -734,24 +1000,156 @@ static void check_threads(struct cpu_freq *cpu_freqs, int max_thread)
 			 * counter.
 			 */
 			cpu_freqs[i].offline = 1;
-			close(cpu_freqs[i].counter);
+			close_counters(&cpu_freqs[i]);
 		}
 	}
 }
 
+static int read_sysfs_counter(int fd, uint64_t *value)
+{
+	char buf[32];
+	ssize_t rc;
+
+	rc = pread(fd, buf, sizeof(buf) - 1, 0);
+	if (rc <= 0)
+		return -1;
+
+	buf[rc] = '\0';
+	*value = strtoull(buf, NULL, 16);
+	return 0;
+}
+
+static int open_sysfs_counter(int cpu, const char *name)
+{
+	char path[128];
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s",
+		 cpu, name);
+	return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void close_scaled_counters(struct cpu_freq *cpu_freqs, int max_thread)
+{
+	int i;
+
+	for (i = 0; i < max_thread; i++) {
+		if (cpu_freqs[i].purr_fd >= 0)
+			close(cpu_freqs[i].purr_fd);
+		if (cpu_freqs[i].spurr_fd >= 0)
+			close(cpu_freqs[i].spurr_fd);
+		cpu_freqs[i].purr_fd = cpu_freqs[i].spurr_fd = -1;
+	}
+}
+
+static int setup_scaled_counters(struct cpu_freq *cpu_freqs, int max_thread)
+{
+	int i;
+
+	for (i = 0; i < max_thread; i++) {
+		cpu_freqs[i].purr_fd = cpu_freqs[i].spurr_fd = -1;
+
+		if (!cpu_online(i)) {
+			cpu_freqs[i].offline = 1;
+			continue;
+		}
+
+		cpu_freqs[i].purr_fd = open_sysfs_counter(i, "purr");
+		cpu_freqs[i].spurr_fd = open_sysfs_counter(i, "spurr");
+		if (cpu_freqs[i].purr_fd < 0 || cpu_freqs[i].spurr_fd < 0) {
+			fprintf(stderr, "Passive frequency determination "
+				"needs the PURR and SPURR of cpu %d: %s\n",
+				i, strerror(errno));
+			close_scaled_counters(cpu_freqs, i + 1);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * The SPURR advances at the PURR rate scaled by the ratio of the actual
+ * to the nominal frequency, so comparing both over an interval yields the
+ * frequency the workload ran at, without running anything on the cpus.
+ * A cpu that could not be read is left out, one that was not dispatched
+ * is left out of the interval.
+ */
+static void read_scaled_counters(struct cpu_freq *cpu_freqs, int max_thread,
+				 double nominal_freq, bool first)
+{
+	uint64_t purr, spurr;
+	int i;
+
+	for (i = 0; i < max_thread; i++) {
+		if (cpu_freqs[i].offline)
+			continue;
+
+		cpu_freqs[i].measured = 0;
+
+		if (read_sysfs_counter(cpu_freqs[i].purr_fd, &purr) ||
+		    read_sysfs_counter(cpu_freqs[i].spurr_fd, &spurr)) {
+			cpu_freqs[i].offline = 1;
+			continue;
+		}
+
+		if (!first && purr != cpu_freqs[i].purr) {
+			cpu_freqs[i].weight = purr - cpu_freqs[i].purr;
+			cpu_freqs[i].freq = nominal_freq *
+				(spurr - cpu_freqs[i].spurr) /
+				cpu_freqs[i].weight;
+			cpu_freqs[i].measured = 1;
+		}
+
+		cpu_freqs[i].purr = purr;
+		cpu_freqs[i].spurr = spurr;
+	}
+}
+
+/* Nominal frequency in GHz, from /proc/cpuinfo */
+static double get_nominal_frequency(void)
+{
+	double freq = 0;
+	char buf[80];
+	FILE *f;
+
+	f = fopen("/proc/cpuinfo", "r");
+	if (!f)
+		return 0;
+
+	while (fgets(buf, sizeof(buf), f) != NULL) {
+		if (!strncmp(buf, "clock", 5) && strchr(buf, ':')) {
+			freq = strtod(strchr(buf, ':') + 1, NULL) / 1000;
+			break;
+		}
+	}
+
+	fclose(f);
+	return freq;
+}
+
 static void *soak(void *arg)
 {
 	unsigned int cpu = (long)arg;
-	cpu_set_t cpumask;
+	size_t size = CPU_ALLOC_SIZE(cpu + 1);
+	cpu_set_t *cpumask;
+
+	cpumask = CPU_ALLOC(cpu + 1);
+	if (!cpumask) {
+		perror("CPU_ALLOC");
+		pthread_exit(NULL);
+	}
 
-	CPU_ZERO(&cpumask);
-	CPU_SET(cpu, &cpumask);
+	CPU_ZERO_S(size, cpumask);
+	CPU_SET_S(cpu, size, cpumask);
 
-	if (sched_setaffinity(0, sizeof(cpumask), &cpumask)) {
+	if (sched_setaffinity(0, size, cpumask)) {
 		perror("sched_setaffinity");
+		CPU_FREE(cpumask);
 		pthread_exit(NULL);
 	}
 
+	CPU_FREE(cpumask);
+
 	while (1)
 		; /* Do Nothing */
 }
@@ -822,11 +1220,11 @@ static void report_system_power_mode(void)
 	return;
 }
 
-/* We need an FD per CPU, with a few more for stdin/out/err etc */
-static void setrlimit_open_files(void)
+/* We need FDs per CPU, with a few more for stdin/out/err etc */
+static void setrlimit_open_files(int fds_per_cpu)
 {
 	struct rlimit old_rlim, new_rlim;
-	int new = threads_in_system + 8;
+	int new = threads_in_system * fds_per_cpu + 8;
 
 	getrlimit(RLIMIT_NOFILE, &old_rlim);
 
@@ -915,37 +1313,10 @@ static int report_platform_energy_freq_mode(struct energy_freq_info *eq)
 	return 0;
 }
 
-static int do_cpu_frequency(int sleep_time)
+static int start_soak_threads(struct cpu_freq *cpu_freqs, int max_thread)
 {
-	int i, rc;
-	double min = -1ULL;
-	unsigned long min_cpu = -1UL;
-	double max = 0;
-	unsigned long max_cpu = -1UL;
-	double sum = 0;
-	unsigned long count = 0;
-	struct cpu_freq *cpu_freqs;
-	struct energy_freq_info eq;
-	int max_thread;
-
-	setrlimit_open_files();
-
-	max_thread = MIN(threads_in_system, CPU_SETSIZE);
-	if (max_thread < threads_in_system)
-		printf("ppc64_cpu currently supports up to %d CPUs\n",
-			CPU_SETSIZE);
-
-	cpu_freqs = calloc(max_thread, sizeof(*cpu_freqs));
-	if (!cpu_freqs)
-		return -ENOMEM;
-
-	rc = setup_counters(cpu_freqs, max_thread);
-	if (rc) {
-		free(cpu_freqs);
-		return rc;
-	}
+	int i;
 
-	/* Start a soak thread on each CPU */
 	for (i = 0; i < max_thread; i++) {
 		if (cpu_freqs[i].offline)
 			continue;
@@ -953,26 +1324,49 @@ static int do_cpu_frequency(int sleep_time)
 		if (pthread_create(&cpu_freqs[i].tid, NULL, soak,
 				   (void *)(long)i)) {
 			perror("pthread_create");
-			free(cpu_freqs);
 			return -1;
 		}
 	}
 
 	/* Wait for soak threads to start */
 	usleep(1000000);
+	return 0;
+}
+
+static void print_platform_frequencies(int eq_rc, struct energy_freq_info *eq)
+{
+	if (eq_rc) {
+		report_system_power_mode();
+		return;
+	}
 
-	start_counters(cpu_freqs, max_thread);
-	/* Count for specified timeout in seconds */
-	usleep(sleep_time * 1000000);
+	printf("Power and Performance Mode: %s", eq->power_perf_mode);
+	printf("Idle Power Saver Status: %s", eq->ips);
+	if (strcmp(eq->ips, "Not Supported\n")) {
+		printf("Processor Folding Status: %d\n",
+		       eq->processor_folding_status);
+	}
+	printf("Platform reported frequencies\n");
+	printf("min\t:\t%.3f GHz\n", (eq->min_freq_mhz/1000));
+	printf("max\t:\t%.3f GHz\n", (eq->max_freq_mhz/1000));
+	printf("static\t:\t%.3f GHz\n\n", (eq->stat_freq_mhz/1000));
+}
 
-	stop_counters(cpu_freqs, max_thread);
-	check_threads(cpu_freqs, max_thread);
-	read_counters(cpu_freqs, max_thread);
+static int print_cpu_frequencies(struct cpu_freq *cpu_freqs, int max_thread,
+				 int eq_rc, struct energy_freq_info *eq)
+{
+	double min = -1ULL;
+	unsigned long min_cpu = -1UL;
+	double max = 0;
+	unsigned long max_cpu = -1UL;
+	double sum = 0;
+	unsigned long count = 0;
+	int i;
 
 	for (i = 0; i < max_thread; i++) {
 		double frequency;
 
-		if (cpu_freqs[i].offline)
+		if (!cpu_freqs[i].measured)
 			continue;
 
 		frequency = cpu_freqs[i].freq;
@@ -989,84 +1383,254 @@ static int do_cpu_frequency(int sleep_time)
 		count++;
 	}
 
-	if (report_platform_energy_freq_mode(&eq)) {
-		report_system_power_mode();
-	} else {
-		printf("Power and Performance Mode: %s", eq.power_perf_mode);
-		printf("Idle Power Saver Status: %s", eq.ips);
-		if (strcmp(eq.ips, "Not Supported\n")) {
-			printf("Processor Folding Status: %d\n",
-			       eq.processor_folding_status);
-		}
-		printf("Platform reported frequencies\n");
-		printf("min\t:\t%.3f GHz\n", (eq.min_freq_mhz/1000));
-		printf("max\t:\t%.3f GHz\n", (eq.max_freq_mhz/1000));
-		printf("static\t:\t%.3f GHz\n\n", (eq.stat_freq_mhz/1000));
+	if (!count) {
+		fprintf(stderr, "No cpu could be measured\n");
+		return -1;
 	}
+
+	print_platform_frequencies(eq_rc, eq);
+
 	printf("Tool Computed frequencies\n");
 	printf("min\t:\t%.3f GHz (cpu %ld)\n", min, min_cpu);
 	printf("max\t:\t%.3f GHz (cpu %ld)\n", max, max_cpu);
 	printf("avg\t:\t%.3f GHz\n", sum / count);
 
-	free(cpu_freqs);
 	return 0;
 }
 
-#else
-
-static int do_cpu_frequency(int sleep_time)
+static int freq_cmp(const void *a, const void *b)
 {
-	printf("CPU Frequency determination is not supported on this "
-	       "platfom.\n");
-	return EINVAL;
-}
+	double fa = *(const double *)a, fb = *(const double *)b;
 
-#endif
+	return fa < fb ? -1 : fa > fb;
+}
 
-static inline void do_cores_present()
+/* Nearest rank percentile of sorted frequencies */
+static double percentile(double *freqs, int nr, int pct)
 {
-	printf("Number of cores present = %d\n", cpus_in_system);
+	int rank = (pct * nr + 99) / 100;
+
+	return freqs[rank ? rank - 1 : 0];
 }
 
-static int set_all_threads_off(int cpu, int smt_state)
+#define FREQ_BUCKETS	20
+#define FREQ_BAR_WIDTH	40
+
+/*
+ * Print the distribution of the core frequencies over the last interval.
+ * The frequency of a core is that of its threads, weighted by the time
+ * each was measured over.
+ */
+static void print_core_frequencies(struct cpu_freq *cpu_freqs, int max_thread,
+				   double *core_freqs, int interval_nr)
 {
-	int i;
-	char path[SYSFS_PATH_MAX];
-	int rc = 0;
+	int buckets[FREQ_BUCKETS];
+	double sum = 0, width, base;
+	int i, j, nr = 0, nr_buckets, max_bucket = 0;
 
-	for (i = cpu + smt_state - 1; i >= cpu; i--) {
-		snprintf(path, SYSFS_PATH_MAX, SYSFS_CPUDIR"/%s", i, "online");
-		rc = offline_thread(path);
-		if (rc == -1)
-			printf("Unable to take cpu%d offline", i);
+	for (i = 0; i < max_thread; i += threads_per_cpu) {
+		double freq = 0, weight = 0;
+
+		for (j = i; j < i + threads_per_cpu && j < max_thread; j++) {
+			if (!cpu_freqs[j].measured)
+				continue;
+
+			freq += cpu_freqs[j].freq * cpu_freqs[j].weight;
+			weight += cpu_freqs[j].weight;
+		}
+
+		if (weight > 0) {
+			core_freqs[nr++] = freq / weight;
+			sum += freq / weight;
+		}
 	}
 
-	return rc;
+	printf("Interval %d: %d cores measured\n", interval_nr, nr);
+	if (!nr) {
+		printf("\n");
+		fflush(stdout);
+		return;
+	}
+
+	qsort(core_freqs, nr, sizeof(*core_freqs), freq_cmp);
+
+	printf("min %.3f  p10 %.3f  p50 %.3f  p90 %.3f  max %.3f  "
+	       "avg %.3f GHz\n", core_freqs[0], percentile(core_freqs, nr, 10),
+	       percentile(core_freqs, nr, 50), percentile(core_freqs, nr, 90),
+	       core_freqs[nr - 1], sum / nr);
+
+	/* 100MHz buckets, widened until the range fits */
+	width = 0.1;
+	do {
+		base = (int)(core_freqs[0] / width) * width;
+		nr_buckets = (int)((core_freqs[nr - 1] - base) / width) + 1;
+		if (nr_buckets > FREQ_BUCKETS)
+			width *= 2;
+	} while (nr_buckets > FREQ_BUCKETS);
+
+	memset(buckets, 0, sizeof(buckets));
+	for (i = 0; i < nr; i++) {
+		j = (core_freqs[i] - base) / width;
+		if (j >= nr_buckets)
+			j = nr_buckets - 1;
+		buckets[j]++;
+	}
+
+	for (i = 0; i < nr_buckets; i++)
+		max_bucket = MAX(max_bucket, buckets[i]);
+
+	for (i = 0; i < nr_buckets; i++) {
+		int len = buckets[i] * FREQ_BAR_WIDTH / max_bucket;
+
+		printf("%6.3f - %6.3f GHz %6d ", base + i * width,
+		       base + (i + 1) * width, buckets[i]);
+		for (j = 0; j < len; j++)
+			putchar('#');
+		putchar('\n');
+	}
+
+	printf("\n");
+	fflush(stdout);
 }
 
-static int set_one_core(int smt_state, int core, int state)
+static int do_cpu_frequency(int sleep_time, int count, char *mode)
 {
-	int rc = 0;
-	int cpu = core * threads_per_cpu;
+	struct cpu_freq *cpu_freqs;
+	struct energy_freq_info eq;
+	struct interval_timer timer;
+	double nominal_freq = 0;
+	double *core_freqs = NULL;
+	bool passive = false;
+	int max_thread;
+	int i, n, rc = 0;
+	int eq_rc;
 
-	if (state) {
-		rc = set_one_smt_state(cpu, smt_state);
-		if (rc == -1)
-			printf("Unable to bring core %d online\n", core);
+	if (mode) {
+		if (strcmp(mode, "passive")) {
+			fprintf(stderr, "Unknown frequency mode %s\n", mode);
+			return -1;
+		}
+		passive = true;
+	}
+
+	setrlimit_open_files(2);
+
+	max_thread = threads_in_system;
+
+	cpu_freqs = calloc(max_thread, sizeof(*cpu_freqs));
+	if (!cpu_freqs)
+		return -ENOMEM;
+
+	for (i = 0; i < max_thread; i++) {
+		cpu_freqs[i].counter = -1;
+		cpu_freqs[i].purr_fd = cpu_freqs[i].spurr_fd = -1;
+	}
+
+	if (count) {
+		core_freqs = calloc(max_thread, sizeof(*core_freqs));
+		if (!core_freqs) {
+			free(cpu_freqs);
+			return -ENOMEM;
+		}
+	}
+
+	memset(&eq, 0, sizeof(eq));
+	eq_rc = report_platform_energy_freq_mode(&eq);
+
+	if (passive) {
+		nominal_freq = !eq_rc && eq.stat_freq_mhz > 0 ?
+			       eq.stat_freq_mhz / 1000 :
+			       get_nominal_frequency();
+		if (nominal_freq <= 0) {
+			fprintf(stderr, "Could not determine the nominal "
+				"frequency\n");
+			rc = -1;
+			goto out;
+		}
+
+		rc = setup_scaled_counters(cpu_freqs, max_thread);
+	} else {
+		rc = setup_counters(cpu_freqs, max_thread);
+		if (!rc)
+			rc = start_soak_threads(cpu_freqs, max_thread);
+	}
+	if (rc)
+		goto out;
+
+	/* The platform values don't change, report them once up front */
+	if (count)
+		print_platform_frequencies(eq_rc, &eq);
+
+	if (passive)
+		read_scaled_counters(cpu_freqs, max_thread, nominal_freq, true);
+	else
+		start_counters(cpu_freqs, max_thread);
+
+	/* Counters stay open across the intervals */
+	interval_timer_start(&timer, sleep_time * 1000LL);
+	for (n = 1; ; n++) {
+		interval_timer_wait(&timer);
+
+		if (passive) {
+			read_scaled_counters(cpu_freqs, max_thread,
+					     nominal_freq, false);
+		} else {
+			/* Stopped counters can be read from the user page */
+			if (n >= count)
+				stop_counters(cpu_freqs, max_thread);
+			check_threads(cpu_freqs, max_thread);
+			read_counters(cpu_freqs, max_thread,
+				      n * sleep_time * 1000000000ULL);
+		}
+
+		if (!count) {
+			rc = print_cpu_frequencies(cpu_freqs, max_thread,
+						   eq_rc, &eq);
+			break;
+		}
+
+		print_core_frequencies(cpu_freqs, max_thread, core_freqs, n);
+		if (n == count)
+			break;
+	}
+
+out:
+	if (passive) {
+		close_scaled_counters(cpu_freqs, max_thread);
 	} else {
-		rc = set_all_threads_off(cpu, smt_state);
-		if (rc == -1)
-			printf("Unable to take core %d offline\n", core);
+		for (i = 0; i < max_thread; i++) {
+			if (!cpu_freqs[i].offline)
+				close_counters(&cpu_freqs[i]);
+		}
 	}
 
+	free(core_freqs);
+	free(cpu_freqs);
 	return rc;
 }
 
+#else
+
+static int do_cpu_frequency(int sleep_time, int count, char *mode)
+{
+	printf("CPU Frequency determination is not supported on this "
+	       "platfom.\n");
+	return EINVAL;
+}
+
+#endif
+
+static inline void do_cores_present()
+{
+	printf("Number of cores present = %d\n", cpus_in_system);
+}
+
 static int do_online_cores(char *cores, int state)
 {
 	int smt_state;
 	int *core_state, *desired_core_state;
-	int i, rc = 0;
+	struct core_op *ops;
+	int i, rc = 0, n_ops = 0;
 	int core;
 	char *str, *token, *end_token;
 	bool first_core = true;
@@ -1089,6 +1653,7 @@ static int do_online_cores(char *cores, int state)
 	if (!core_state)
 		return -ENOMEM;
 
+	refresh_online();
 	for (i = 0; i < cpus_in_system ; i++)
 		core_state[i] = (get_one_smt_state(i) > 0);
 
@@ -1155,14 +1720,25 @@ static int do_online_cores(char *cores, int state)
 		return rc;
 	}
 
+	ops = calloc(cpus_in_system, sizeof(*ops));
+	if (!ops) {
+		free(core_state);
+		free(desired_core_state);
+		return -ENOMEM;
+	}
+
 	for (i = 0; i < cpus_in_system; i++) {
 		if (desired_core_state[i] != -1) {
-			rc = set_one_core(smt_state, i, state);
-			if (rc)
-				break;
+			ops[n_ops].core = i;
+			ops[n_ops].online_threads = state ? smt_state : 0;
+			n_ops++;
 		}
 	}
 
+	if (run_core_ops(ops, n_ops))
+		rc = -1;
+
+	free(ops);
 	free(core_state);
 	free(desired_core_state);
 	return rc;
@@ -1172,8 +1748,9 @@ static int do_cores_on(char *state)
 {
 	int smt_state;
 	int *core_state;
+	struct core_op *ops;
 	int cores_now_online = 0;
-	int i, rc;
+	int i;
 	int number_to_have, number_to_change = 0, number_changed = 0;
 	int new_state;
 	char *end_state;
@@ -1194,6 +1771,7 @@ static int do_cores_on(char *state)
 	if (!core_state)
 		return -ENOMEM;
 
+	refresh_online();
 	for (i = 0; i < cpus_in_system ; i++) {
 		core_state[i] = (get_one_smt_state(i) > 0);
 		if (core_state[i])
@@ -1246,32 +1824,44 @@ static int do_cores_on(char *state)
 		new_state = 0;
 	}
 
-	if (new_state) {
-		for (i = 0; i < cpus_in_system; i++) {
-			if (!core_state[i]) {
-				rc = set_one_core(smt_state, i, new_state);
-				if (!rc)
-					number_changed++;
-				if (number_changed >= number_to_change)
-					break;
-			}
-		}
-	} else {
-		for (i = cpus_in_system - 1; i > 0; i--) {
-			if (core_state[i]) {
-				rc = set_one_core(smt_state, i, new_state);
-				if (!rc)
-					number_changed++;
-				if (number_changed >= number_to_change)
-					break;
+	ops = calloc(number_to_change, sizeof(*ops));
+	if (!ops) {
+		free(core_state);
+		return -ENOMEM;
+	}
+
+	/*
+	 * Cores are onlined from the first one and offlined from the last
+	 * one, core 0 is never offlined. Cores which fail are replaced by
+	 * the next candidates.
+	 */
+	i = new_state ? 0 : cpus_in_system - 1;
+	while (number_changed < number_to_change) {
+		int n_ops = 0;
+
+		while (n_ops < number_to_change - number_changed &&
+		       (new_state ? i < cpus_in_system : i > 0)) {
+			if (core_state[i] != new_state) {
+				ops[n_ops].core = i;
+				ops[n_ops].online_threads =
+					new_state ? smt_state : 0;
+				n_ops++;
 			}
+			i += new_state ? 1 : -1;
 		}
+
+		if (!n_ops)
+			break;
+
+		number_changed += n_ops - run_core_ops(ops, n_ops);
 	}
+	free(ops);
 
 	if (number_changed != number_to_change) {
+		refresh_online();
 		cores_now_online = 0;
 		for (i = 0; i < cpus_in_system ; i++) {
-			if (cpu_online(i * threads_per_cpu))
+			if (get_one_smt_state(i))
 				cores_now_online++;
 		}
 		printf("Failed to set requested number of cores online.\n"
@@ -1299,6 +1889,8 @@ static int do_info(void)
 	if (is_subcore_capable())
 		subcores = num_subcores();
 
+	refresh_online();
+
 	for (i = 0, core = 0; core < cpus_in_system; i++) {
 
 		if (!core_is_online(i))
@@ -1314,7 +1906,11 @@ static int do_info(void)
 
 		thread_num = i * threads_per_cpu;
 		for (j = 0; j < threads_per_cpu; j++, thread_num++) {
-			online = cpu_online(thread_num) ? '*' : ' ';
+			if (online_mask_valid)
+				online = topology_cpu_online(thread_num);
+			else
+				online = cpu_online(thread_num);
+			online = online ? '*' : ' ';
 			printf("%4d%c ", thread_num, online);
 		}
 		printf("\n");
@@ -1343,12 +1939,21 @@ static void usage(void)
 "ppc64_cpu --run-mode                # Get current diagnostics run mode\n"
 "ppc64_cpu --run-mode=<val>          # Set current diagnostics run mode\n\n"
 "ppc64_cpu --frequency [-t <time>]   # Determine cpu frequency for <time>\n"
-"                                    # seconds, default is 1 second.\n\n"
+"                                    # seconds, default is 1 second.\n"
+"ppc64_cpu --frequency=passive [-t <time>]\n"
+"                                    # Determine the frequency the current\n"
+"                                    # workload runs at, from PURR/SPURR.\n"
+"ppc64_cpu --frequency[=passive] -t <time> -c <count>\n"
+"                                    # Report the distribution of the core\n"
+"                                    # frequencies every <time> seconds,\n"
+"                                    # <count> times.\n\n"
 "ppc64_cpu --subcores-per-core       # Get number of subcores per core\n"
 "ppc64_cpu --subcores-per-core=X     # Set subcores per core to X (1 or 4)\n"
 "ppc64_cpu --threads-per-core        # Get threads per core\n"
 "ppc64_cpu --info                    # Display system state information\n"
-"ppc64_cpu --version                 # Display version of ppc64-cpu\n");
+"ppc64_cpu --version                 # Display version of ppc64-cpu\n\n"
+"The commands changing the state of cores accept [-j <jobs>] to run up to\n"
+"<jobs> core transitions at once, default is 1.\n");
 }
 
 struct option longopts[] = {
@@ -1374,6 +1979,7 @@ int main(int argc, char *argv[])
 	char *equal_char;
 	int opt;
 	int sleep_time = 1; /* default to one second */
+	int count = 0;
 	bool numeric = false;
 	pid_t pid = -1;
 
@@ -1406,7 +2012,7 @@ int main(int argc, char *argv[])
 	/* Now parse out any additional options. */
 	optind = 2;
 	while (1) {
-		opt = getopt(argc, argv, "p:t:n");
+		opt = getopt(argc, argv, "p:t:c:nj:");
 		if (opt == -1)
 			break;
 
@@ -1433,6 +2039,22 @@ int main(int argc, char *argv[])
 
 			sleep_time = atoi(optarg);
 			break;
+		case 'c':
+			/* only valid for --frequency */
+			if (strcmp(action, "frequency")) {
+				fprintf(stderr, "The c option is only valid "
+					"with the --frequency option\n");
+				usage();
+				exit(-1);
+			}
+
+			count = atoi(optarg);
+			if (count < 1) {
+				fprintf(stderr, "The count must be at least "
+					"1\n");
+				exit(-1);
+			}
+			break;
 		case 'n':
 			if (strcmp(action, "smt")) {
 				fprintf(stderr, "The n option is only valid "
@@ -1442,6 +2064,28 @@ int main(int argc, char *argv[])
 			}
 			numeric = true;
 			break;
+		case 'j':
+			if (strcmp(action, "smt") &&
+			    strcmp(action, "cores-on") &&
+			    strcmp(action, "online-cores") &&
+			    strcmp(action, "offline-cores")) {
+				fprintf(stderr, "The j option is only valid "
+					"with the --smt, --cores-on, "
+					"--online-cores and --offline-cores "
+					"options\n");
+				usage();
+				exit(-1);
+			}
+
+			hotplug_jobs = atoi(optarg);
+			if (hotplug_jobs < 1 ||
+			    hotplug_jobs > MAX_HOTPLUG_JOBS) {
+				fprintf(stderr, "The number of jobs must be "
+					"between 1 and %d\n",
+					MAX_HOTPLUG_JOBS);
+				exit(-1);
+			}
+			break;
 		default:
 			fprintf(stderr, "%c is not a valid option\n", opt);
 			usage();
@@ -1456,7 +2100,7 @@ int main(int argc, char *argv[])
 	else if (!strcmp(action, "run-mode"))
 		rc = do_run_mode(action_arg);
 	else if (!strcmp(action, "frequency"))
-		rc = do_cpu_frequency(sleep_time);
+		rc = do_cpu_frequency(sleep_time, count, action_arg);
 	else if (!strcmp(action, "cores-present"))
 		do_cores_present();
 	else if (!strcmp(action, "cores-on"))
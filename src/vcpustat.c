@@ -26,18 +26,27 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <getopt.h>
+#include <poll.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/un.h>
 #include "pseries_platform.h"
+#include "interval_timer.h"
+#include "cpu_topology.h"
 
 #define VCPUSTAT_FILE	"/proc/powerpc/vcpudispatch_stats"
 #define NR_CPUS 4096
+#define DAEMON_INTERVAL	1000	/* ms */
+#define DAEMON_HISTORY	60	/* intervals */
 
 struct vcpudispatch_stat {
-	unsigned long idx;
+	int cpu;
 	int total;
 	int same_cpu;
 	int same_chip;
@@ -48,191 +57,468 @@ struct vcpudispatch_stat {
 	int far_numa_node;
 };
 
-unsigned long idx;
+/* Statistics of the online cpus, in increasing cpu order */
+struct vcpudispatch_sample {
+	int nr;
+	struct vcpudispatch_stat *stats;
+};
+
 int retain_stats, numeric_stats, raw_stats, stats_off, intr;
 
-int read_stats(struct vcpudispatch_stat stats[])
+/* Number of possible cpus, which bounds the cpus listed in the stats */
+static int nr_cpus;
+
+enum aggregate_level {
+	AGGREGATE_CPU,
+	AGGREGATE_CORE,
+	AGGREGATE_CHIP,
+	AGGREGATE_NODE,
+};
+
+static const char *aggregate_names[] = { "cpu", "core", "chip", "node" };
+static enum aggregate_level aggregate = AGGREGATE_CPU;
+static int top_n;
+
+/* Lines of the current report, one per cpu or per aggregate */
+static struct vcpudispatch_stat *rows;
+
+/*
+ * Daemon mode keeps the per cpu deltas of the last intervals in a ring,
+ * along with their running sum, indexed by cpu.
+ */
+struct dispatch_history {
+	int size;
+	int nr;
+	int next;
+	struct vcpudispatch_sample *deltas;
+	struct vcpudispatch_stat *window;
+	int *window_nr;		/* intervals each cpu is present in */
+};
+
+static int stats_fd = -1;
+static char *stats_buf;
+static size_t stats_buf_sz;
+
+static int alloc_sample(struct vcpudispatch_sample *sample)
 {
-	struct vcpudispatch_stat stat;
-	int cpu, rc = -1;
-	char buf[144];
-	FILE *f;
+	sample->nr = 0;
+	sample->stats = calloc(nr_cpus, sizeof(struct vcpudispatch_stat));
+	if (!sample->stats) {
+		fprintf(stderr, "Error allocating memory for stats\n");
+		return -1;
+	}
 
-	f = fopen(VCPUSTAT_FILE, "r");
-	if (!f) {
-		fprintf(stderr, "Could not open %s\n", VCPUSTAT_FILE);
+	return 0;
+}
+
+/* Read the whole stats file into stats_buf, nul terminated */
+static int read_stats_file(void)
+{
+	size_t len = 0;
+	ssize_t rc;
+	char *buf;
+
+	if (stats_fd == -1) {
+		stats_fd = open(VCPUSTAT_FILE, O_RDONLY);
+		if (stats_fd == -1) {
+			fprintf(stderr, "Could not open %s\n", VCPUSTAT_FILE);
+			return -1;
+		}
+	}
+
+	while (1) {
+		if (stats_buf_sz - len < 2) {
+			/* Roughly one 128 byte line per cpu */
+			size_t size = stats_buf_sz ? stats_buf_sz * 2 :
+					(size_t)nr_cpus * 128;
+
+			buf = realloc(stats_buf, size);
+			if (!buf) {
+				fprintf(stderr, "Error allocating memory for stats\n");
+				return -1;
+			}
+
+			stats_buf = buf;
+			stats_buf_sz = size;
+		}
+
+		rc = pread(stats_fd, stats_buf + len, stats_buf_sz - len - 1,
+			   len);
+		if (rc == -1) {
+			if (errno == EINTR && !intr)
+				continue;
+
+			fprintf(stderr, "Could not read %s\n", VCPUSTAT_FILE);
+			return -1;
+		}
+
+		if (rc == 0)
+			break;
+
+		len += rc;
+	}
+
+	stats_buf[len] = '\0';
+	return 0;
+}
+
+/* Parse the unsigned decimal number at *p, skipping leading blanks */
+static int scan_int(char **p, int *value)
+{
+	unsigned int v = 0;
+	char *s = *p;
+
+	while (*s == ' ')
+		s++;
+
+	if (*s < '0' || *s > '9')
 		return -1;
+
+	while (*s >= '0' && *s <= '9')
+		v = v * 10 + (*s++ - '0');
+
+	*p = s;
+	*value = v;
+	return 0;
+}
+
+static int parse_stat_line(char **line, struct vcpudispatch_stat *stat)
+{
+	char *p = *line;
+	int *fields[] = {
+		&stat->total, &stat->same_cpu, &stat->same_chip,
+		&stat->same_package, &stat->diff_package,
+		&stat->home_numa_node, &stat->next_numa_node,
+		&stat->far_numa_node,
+	};
+	int i;
+
+	if (strncmp(p, "cpu", 3))
+		return -1;
+
+	p += 3;
+	if (scan_int(&p, &stat->cpu))
+		return -1;
+
+	for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+		if (scan_int(&p, fields[i]))
+			return -1;
 	}
 
-	if ((fgets(buf, 144, f)) == NULL) {
+	p = strchr(p, '\n');
+	*line = p ? p + 1 : *line + strlen(*line);
+	return 0;
+}
+
+int read_stats(struct vcpudispatch_sample *sample)
+{
+	struct vcpudispatch_stat stat;
+	char *line;
+
+	sample->nr = 0;
+
+	if (read_stats_file())
+		return -1;
+
+	line = stats_buf;
+	if (*line == '\0') {
 		fprintf(stderr, "Could not read %s\n", VCPUSTAT_FILE);
-		goto out;
+		return -1;
 	}
 
-	if (!strncmp(buf, "off", 3)) {
+	if (!strncmp(line, "off", 3)) {
 		stats_off = 1;
-		rc = 0; /* not an error */
-		goto out;
+		return 0; /* not an error */
 	} else
 		stats_off = 0;
 
-	idx++;
-
-	do {
-		rc = sscanf(buf, "cpu%d %d %d %d %d %d %d %d %d", &cpu,
-				  &stat.total, &stat.same_cpu, &stat.same_chip,
-				  &stat.same_package, &stat.diff_package,
-				  &stat.home_numa_node, &stat.next_numa_node,
-				  &stat.far_numa_node);
-		if (rc != 9) {
+	while (!intr && *line != '\0') {
+		if (parse_stat_line(&line, &stat)) {
 			fprintf(stderr, "Error parsing %s\n", VCPUSTAT_FILE);
-			goto out;
+			return -1;
 		}
-		if (cpu < 0 || cpu >= NR_CPUS) {
-			fprintf(stderr, "Cpu (%d) out of range\n", cpu);
-			goto out;
+
+		if (stat.cpu < 0 || stat.cpu >= nr_cpus ||
+		    sample->nr == nr_cpus) {
+			fprintf(stderr, "Cpu (%d) out of range\n", stat.cpu);
+			return -1;
 		}
-		stat.idx = idx;
-		stats[cpu] = stat;
-	} while (!intr && (fgets(buf, 144, f)) != NULL);
 
-	rc = 0;
+		sample->stats[sample->nr++] = stat;
+	}
 
-out:
-	fclose(f);
-	return rc;
+	return 0;
+}
+
+/* Follow cpus coming and going, so their groups are read from sysfs again */
+static void update_topology(void)
+{
+	if (aggregate != AGGREGATE_CPU)
+		cpu_topology_update_online();
+}
+
+/* Core, chip or node of a cpu, depending on the aggregation level */
+static int cpu_group(int cpu)
+{
+	switch (aggregate) {
+	case AGGREGATE_CPU:
+		return cpu;
+	case AGGREGATE_CORE:
+		return topology_cpu_core(cpu);
+	case AGGREGATE_CHIP:
+		return topology_cpu_chip(cpu);
+	default:
+		return topology_cpu_node(cpu);
+	}
+}
+
+static void accumulate_stat(struct vcpudispatch_stat *dst,
+			    struct vcpudispatch_stat *src, int sign)
+{
+	dst->total += sign * src->total;
+	dst->same_cpu += sign * src->same_cpu;
+	dst->same_chip += sign * src->same_chip;
+	dst->same_package += sign * src->same_package;
+	dst->diff_package += sign * src->diff_package;
+	dst->home_numa_node += sign * src->home_numa_node;
+	dst->next_numa_node += sign * src->next_numa_node;
+	dst->far_numa_node += sign * src->far_numa_node;
+}
+
+/* Add the statistics of a cpu to the row of its group */
+static void add_row(int *nr_rows, struct vcpudispatch_stat *stat)
+{
+	struct vcpudispatch_stat *row = NULL;
+	int group = cpu_group(stat->cpu);
+	int i;
+
+	/* The threads of a core are adjacent, try the last row first */
+	if (*nr_rows && rows[*nr_rows - 1].cpu == group) {
+		row = &rows[*nr_rows - 1];
+	} else if (aggregate != AGGREGATE_CPU) {
+		for (i = 0; i < *nr_rows; i++) {
+			if (rows[i].cpu == group) {
+				row = &rows[i];
+				break;
+			}
+		}
+	}
+
+	if (!row) {
+		row = &rows[(*nr_rows)++];
+		memset(row, 0, sizeof(*row));
+		row->cpu = group;
+	}
+
+	accumulate_stat(row, stat, 1);
+}
+
+static int row_cmp(const void *a, const void *b)
+{
+	const struct vcpudispatch_stat *ra = a, *rb = b;
+
+	return ra->cpu - rb->cpu;
+}
+
+/* Highest share of far numa node dispatches first */
+static int row_far_cmp(const void *a, const void *b)
+{
+	const struct vcpudispatch_stat *ra = a, *rb = b;
+	double fa, fb;
+
+	fa = ra->total ? (double)ra->far_numa_node / ra->total : 0;
+	fb = rb->total ? (double)rb->far_numa_node / rb->total : 0;
+	if (fa != fb)
+		return fa < fb ? 1 : -1;
+
+	return ra->cpu - rb->cpu;
+}
+
+/* Order the rows for printing, returns the number of rows to print */
+static int sort_rows(int nr_rows)
+{
+	if (top_n) {
+		qsort(rows, nr_rows, sizeof(*rows), row_far_cmp);
+		if (nr_rows > top_n)
+			nr_rows = top_n;
+	} else if (aggregate != AGGREGATE_CPU) {
+		qsort(rows, nr_rows, sizeof(*rows), row_cmp);
+	}
+
+	return nr_rows;
 }
 
-void print_alltime_stats(struct vcpudispatch_stat stats[])
+static const char *row_label(struct vcpudispatch_stat *row)
+{
+	static char label[32];
+
+	if (row->cpu < 0)
+		snprintf(label, sizeof(label), "%s?",
+			 aggregate_names[aggregate]);
+	else
+		snprintf(label, sizeof(label), "%s%d",
+			 aggregate_names[aggregate], row->cpu);
+
+	return label;
+}
+
+static void print_raw_header(void)
 {
 	char raw_header1[] = "%22s %43s | %32s\n";
 	char raw_header2[] = "%-7s | %10s | %10s %10s %10s %10s | %10s %10s %10s\n";
-	char raw_fmt[] = "cpu%-4d | %10d | %10d %10d %10d %10d | %10d %10d %10d\n";
-	int i;
 
 	printf(raw_header1, " ",
 				"========== dispatch dispersions ==========",
 				"======= numa dispersions =======");
-	printf(raw_header2, "cpu", "total",
+	printf(raw_header2, aggregate_names[aggregate], "total",
 					"core", "chip", "socket", "cec",
 					"home", "adj", "far");
+}
 
-	for (i = 0; i < NR_CPUS; i++) {
-		if (!stats[i].idx)
-			continue;
+static void print_raw_rows(int nr_rows)
+{
+	char raw_fmt[] = "%-7s | %10d | %10d %10d %10d %10d | %10d %10d %10d\n";
+	int i;
 
-		printf(raw_fmt, i,
-			stats[i].total, stats[i].same_cpu, stats[i].same_chip,
-			stats[i].same_package, stats[i].diff_package,
-			stats[i].home_numa_node, stats[i].next_numa_node,
-			stats[i].far_numa_node);
-	}
+	for (i = 0; i < nr_rows; i++)
+		printf(raw_fmt, row_label(&rows[i]),
+			rows[i].total, rows[i].same_cpu, rows[i].same_chip,
+			rows[i].same_package, rows[i].diff_package,
+			rows[i].home_numa_node, rows[i].next_numa_node,
+			rows[i].far_numa_node);
+}
+
+void print_alltime_stats(struct vcpudispatch_sample *sample)
+{
+	int i, nr_rows = 0;
+
+	for (i = 0; i < sample->nr; i++)
+		add_row(&nr_rows, &sample->stats[i]);
+
+	nr_rows = sort_rows(nr_rows);
+
+	print_raw_header();
+	print_raw_rows(nr_rows);
 
 	printf("\n");
 	fflush(stdout);
 }
 
-void print_stats(struct vcpudispatch_stat stats1[],
-		 struct vcpudispatch_stat stats2[])
+/*
+ * Difference of two samples, for the cpus online in both. Counters restart
+ * from zero when the statistics are enabled again, such cpus are left out.
+ */
+static void diff_samples(struct vcpudispatch_sample *sample1,
+			 struct vcpudispatch_sample *sample2,
+			 struct vcpudispatch_sample *delta)
+{
+	struct vcpudispatch_stat *stats1, *stats2, *stat;
+	int i, j;
+
+	delta->nr = 0;
+
+	/* Both samples are sorted by cpu */
+	for (i = 0, j = 0; i < sample2->nr; i++) {
+		while (j < sample1->nr &&
+		       sample1->stats[j].cpu < sample2->stats[i].cpu)
+			j++;
+
+		if (j == sample1->nr)
+			break;
+
+		if (sample1->stats[j].cpu != sample2->stats[i].cpu)
+			continue;
+
+		stats1 = &sample1->stats[j];
+		stats2 = &sample2->stats[i];
+		if (stats2->total < stats1->total)
+			continue;
+
+		stat = &delta->stats[delta->nr++];
+		*stat = *stats2;
+		accumulate_stat(stat, stats1, -1);
+	}
+}
+
+void print_stats(struct vcpudispatch_sample *sample)
 {
 	char percent_header1[] = "%35s | %20s\n";
 	char percent_header2[] = "%-7s %6s %6s %6s %6s | %6s %6s %6s\n";
-	char percent_fmt[] = "cpu%-4d %6.2f %6.2f %6.2f %6.2f | %6.2f %6.2f %6.2f\n";
-	char raw_header1[] = "%22s %43s | %32s\n";
-	char raw_header2[] = "%-7s | %10s | %10s %10s %10s %10s | %10s %10s %10s\n";
-	char raw_fmt[] = "cpu%-4d | %10d | %10d %10d %10d %10d | %10d %10d %10d\n";
-	struct vcpudispatch_stat stat = {};
-	int i;
+	char percent_fmt[] = "%-7s %6.2f %6.2f %6.2f %6.2f | %6.2f %6.2f %6.2f\n";
+	int i, nr_rows = 0;
 
 	if (stats_off) {
 		printf("off\n");
 		return;
 	}
 
+	for (i = 0; i < sample->nr; i++)
+		add_row(&nr_rows, &sample->stats[i]);
+
+	nr_rows = sort_rows(nr_rows);
+
 	if (numeric_stats || raw_stats) {
-		printf(raw_header1, " ",
-				"========== dispatch dispersions ==========",
-				"======= numa dispersions =======");
-		printf(raw_header2, "cpu", "total",
-					"core", "chip", "socket", "cec",
-					"home", "adj", "far");
+		print_raw_header();
+		print_raw_rows(nr_rows);
 	} else {
 		printf(percent_header1, "         == dispatch dispersions ==",
 					"= numa dispersions =");
-		printf(percent_header2, "cpu", "core", "chip", "socket", "cec",
+		printf(percent_header2, aggregate_names[aggregate],
+					"core", "chip", "socket", "cec",
 					"home", "adj", "far");
-	}
 
-	for (i = 0; i < NR_CPUS; i++) {
-		if (stats2[i].idx != idx || stats1[i].idx != (idx - 1))
-			continue;
-
-		if (!raw_stats) {
-			stat.total = stats2[i].total - stats1[i].total;
-			stat.same_cpu = stats2[i].same_cpu - stats1[i].same_cpu;
-			stat.same_chip = stats2[i].same_chip - stats1[i].same_chip;
-			stat.same_package = stats2[i].same_package - stats1[i].same_package;
-			stat.diff_package = stats2[i].diff_package - stats1[i].diff_package;
-			stat.home_numa_node = stats2[i].home_numa_node - stats1[i].home_numa_node;
-			stat.next_numa_node = stats2[i].next_numa_node - stats1[i].next_numa_node;
-			stat.far_numa_node = stats2[i].far_numa_node - stats1[i].far_numa_node;
-		}
-
-		if (numeric_stats)
-			printf(raw_fmt, i,
-				stat.total, stat.same_cpu, stat.same_chip,
-				stat.same_package, stat.diff_package,
-				stat.home_numa_node, stat.next_numa_node,
-				stat.far_numa_node);
-		else if (raw_stats)
-			printf(raw_fmt, i,
-				stats2[i].total, stats2[i].same_cpu, stats2[i].same_chip,
-				stats2[i].same_package, stats2[i].diff_package,
-				stats2[i].home_numa_node, stats2[i].next_numa_node,
-				stats2[i].far_numa_node);
-		else
-			printf(percent_fmt, i,
-				100 * (float)stat.same_cpu / stat.total,
-				100 * (float)stat.same_chip / stat.total,
-				100 * (float)stat.same_package / stat.total,
-				100 * (float)stat.diff_package / stat.total,
-				100 * (float)stat.home_numa_node / stat.total,
-				100 * (float)stat.next_numa_node / stat.total,
-				100 * (float)stat.far_numa_node / stat.total);
+		for (i = 0; i < nr_rows; i++)
+			printf(percent_fmt, row_label(&rows[i]),
+				100 * (float)rows[i].same_cpu / rows[i].total,
+				100 * (float)rows[i].same_chip / rows[i].total,
+				100 * (float)rows[i].same_package / rows[i].total,
+				100 * (float)rows[i].diff_package / rows[i].total,
+				100 * (float)rows[i].home_numa_node / rows[i].total,
+				100 * (float)rows[i].next_numa_node / rows[i].total,
+				100 * (float)rows[i].far_numa_node / rows[i].total);
 	}
 
 	printf("\n");
 	fflush(stdout);
 }
 
-void process_stats(int interval, int count)
+void process_stats(long long interval, int count)
 {
-	struct vcpudispatch_stat *stats1, *stats2, *stats_tmp;
+	struct vcpudispatch_sample samples[2], *sample1, *sample2, *tmp;
+	struct vcpudispatch_sample delta = {};
+	struct interval_timer timer;
 	int rc, dec = count;
 
-	stats1 = calloc(NR_CPUS, sizeof(struct vcpudispatch_stat));
-	stats2 = calloc(NR_CPUS, sizeof(struct vcpudispatch_stat));
-
-	if (!stats1 || !stats2) {
-		fprintf(stderr, "Error allocating memory for stats\n");
+	if (alloc_sample(&samples[0]))
 		return;
-	}
+	if (alloc_sample(&samples[1]) || alloc_sample(&delta))
+		goto out;
+
+	sample1 = &samples[0];
+	sample2 = &samples[1];
 
-	rc = read_stats(stats1);
+	interval_timer_start(&timer, interval);
+	rc = read_stats(sample1);
 	if (rc)
 		goto out;
-	sleep(interval);
+	interval_timer_wait(&timer);
 
 	while (!intr) {
-		rc = read_stats(stats2);
+		update_topology();
+		rc = read_stats(sample2);
 		if (rc)
 			goto out;
 
-		print_stats(stats1, stats2);
+		if (raw_stats) {
+			print_stats(sample2);
+		} else {
+			diff_samples(sample1, sample2, &delta);
+			print_stats(&delta);
+		}
 
-		stats_tmp = stats2;
-		stats2 = stats1;
-		stats1 = stats_tmp;
+		tmp = sample2;
+		sample2 = sample1;
+		sample1 = tmp;
 
 		if (count) {
 			dec--;
@@ -241,27 +527,24 @@ void process_stats(int interval, int count)
 		}
 
 		if (!intr)
-			sleep(interval);
+			interval_timer_wait(&timer);
 	}
 
 out:
-	free(stats1);
-	free(stats2);
+	free(samples[0].stats);
+	free(samples[1].stats);
+	free(delta.stats);
 }
 
 void display_raw_counts(void)
 {
-	struct vcpudispatch_stat *stats;
+	struct vcpudispatch_sample sample;
 	int rc;
 
-	stats = calloc(NR_CPUS, sizeof(struct vcpudispatch_stat));
-
-	if (!stats) {
-		fprintf(stderr, "Error allocating memory for stats\n");
+	if (alloc_sample(&sample))
 		return;
-	}
 
-	rc = read_stats(stats);
+	rc = read_stats(&sample);
 	if (rc)
 		goto out;
 
@@ -271,10 +554,10 @@ void display_raw_counts(void)
 		goto out;
 	}
 
-	print_alltime_stats(stats);
+	print_alltime_stats(&sample);
 
 out:
-	free(stats);
+	free(sample.stats);
 }
 
 int init_stats(bool enable, bool user_requested)
@@ -341,6 +624,306 @@ void disable_stats(void)
 	fclose(f);
 }
 
+static int alloc_history(struct dispatch_history *hist, int size)
+{
+	int i;
+
+	memset(hist, 0, sizeof(*hist));
+	hist->size = size;
+	hist->deltas = calloc(size, sizeof(*hist->deltas));
+	hist->window = calloc(nr_cpus, sizeof(*hist->window));
+	hist->window_nr = calloc(nr_cpus, sizeof(*hist->window_nr));
+	if (!hist->deltas || !hist->window || !hist->window_nr) {
+		fprintf(stderr, "Error allocating memory for stats\n");
+		return -1;
+	}
+
+	for (i = 0; i < size; i++) {
+		if (alloc_sample(&hist->deltas[i]))
+			return -1;
+	}
+
+	for (i = 0; i < nr_cpus; i++)
+		hist->window[i].cpu = i;
+
+	return 0;
+}
+
+static void free_history(struct dispatch_history *hist)
+{
+	int i;
+
+	for (i = 0; hist->deltas && i < hist->size; i++)
+		free(hist->deltas[i].stats);
+
+	free(hist->deltas);
+	free(hist->window);
+	free(hist->window_nr);
+}
+
+/* Record the deltas of an interval, dropping the oldest one once full */
+static void add_history(struct dispatch_history *hist,
+			struct vcpudispatch_sample *sample1,
+			struct vcpudispatch_sample *sample2)
+{
+	struct vcpudispatch_sample *slot = &hist->deltas[hist->next];
+	struct vcpudispatch_stat *stat;
+	int i;
+
+	if (hist->nr == hist->size) {
+		for (i = 0; i < slot->nr; i++) {
+			stat = &slot->stats[i];
+			accumulate_stat(&hist->window[stat->cpu], stat, -1);
+			hist->window_nr[stat->cpu]--;
+		}
+	} else {
+		hist->nr++;
+	}
+
+	diff_samples(sample1, sample2, slot);
+
+	for (i = 0; i < slot->nr; i++) {
+		stat = &slot->stats[i];
+		accumulate_stat(&hist->window[stat->cpu], stat, 1);
+		hist->window_nr[stat->cpu]++;
+	}
+
+	hist->next = (hist->next + 1) % hist->size;
+}
+
+static void write_rows(FILE *f, const char *name, int intervals, int nr_rows)
+{
+	int i;
+
+	fprintf(f, "%s %d %d\n", name, intervals, nr_rows);
+	for (i = 0; i < nr_rows; i++)
+		fprintf(f, "%s %d %d %d %d %d %d %d %d\n", row_label(&rows[i]),
+			rows[i].total, rows[i].same_cpu, rows[i].same_chip,
+			rows[i].same_package, rows[i].diff_package,
+			rows[i].home_numa_node, rows[i].next_numa_node,
+			rows[i].far_numa_node);
+}
+
+/*
+ * Report the aggregates of the last interval and of the whole history.
+ * Each section starts with "<name> <intervals> <rows>", followed by rows
+ * in the format of the stats file.
+ */
+static char *format_history(struct dispatch_history *hist,
+			    long long interval, size_t *len)
+{
+	struct vcpudispatch_sample *latest;
+	char *report = NULL;
+	int i, nr_rows = 0;
+	FILE *f;
+
+	f = open_memstream(&report, len);
+	if (!f)
+		return NULL;
+
+	fprintf(f, "interval %lld\n", interval);
+
+	if (hist->nr) {
+		latest = &hist->deltas[(hist->next + hist->size - 1) %
+				       hist->size];
+		for (i = 0; i < latest->nr; i++)
+			add_row(&nr_rows, &latest->stats[i]);
+		nr_rows = sort_rows(nr_rows);
+	}
+	write_rows(f, "latest", hist->nr ? 1 : 0, nr_rows);
+
+	nr_rows = 0;
+	for (i = 0; i < nr_cpus; i++) {
+		if (hist->window_nr[i])
+			add_row(&nr_rows, &hist->window[i]);
+	}
+	nr_rows = sort_rows(nr_rows);
+	write_rows(f, "window", hist->nr, nr_rows);
+
+	if (fclose(f)) {
+		free(report);
+		return NULL;
+	}
+
+	return report;
+}
+
+static int open_socket(const char *path)
+{
+	struct sockaddr_un addr;
+	struct stat sb;
+	mode_t old_mask;
+	int fd, rc;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Socket path %s is too long\n", path);
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		fprintf(stderr, "Could not create socket: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	/*
+	 * Replace the socket left behind by a previous instance, but not
+	 * the one of a daemon still serving it.
+	 */
+	if (!lstat(path, &sb) && S_ISSOCK(sb.st_mode)) {
+		if (!connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			fprintf(stderr, "vcpustat is already running on %s\n",
+				path);
+			close(fd);
+			return -1;
+		}
+
+		unlink(path);
+	}
+
+	close(fd);
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		fprintf(stderr, "Could not create socket: %s\n",
+			strerror(errno));
+		return -1;
+	}
+
+	/* Only the caller's user may read the statistics */
+	old_mask = umask(0177);
+	rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+	umask(old_mask);
+
+	if (rc || listen(fd, 16)) {
+		fprintf(stderr, "Could not listen on %s: %s\n", path,
+			strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Send the current report to each pending client, then hang up */
+static void serve_clients(int listen_fd, struct dispatch_history *hist,
+			  long long interval)
+{
+	struct timeval timeout = { .tv_sec = 1 };
+	char *report = NULL;
+	size_t len = 0, off;
+	ssize_t rc;
+	int fd;
+
+	while ((fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC)) != -1) {
+		if (!report) {
+			report = format_history(hist, interval, &len);
+			if (!report) {
+				close(fd);
+				break;
+			}
+		}
+
+		/* A client that does not read must not stall sampling */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+			   sizeof(timeout));
+
+		for (off = 0; off < len; off += rc) {
+			rc = send(fd, report + off, len - off, MSG_NOSIGNAL);
+			if (rc <= 0)
+				break;
+		}
+
+		close(fd);
+	}
+
+	free(report);
+}
+
+/**
+ * run_daemon
+ * @brief Sample the dispatch statistics and serve them over a socket
+ *
+ * @param path path of the Unix socket to listen on
+ * @param interval sampling interval in milliseconds
+ * @param history number of intervals kept
+ * @returns 0 on success, -1 on error
+ */
+int run_daemon(const char *path, long long interval, int history)
+{
+	struct vcpudispatch_sample samples[2], *sample1, *sample2, *tmp;
+	struct dispatch_history hist;
+	struct interval_timer timer;
+	struct pollfd pfd;
+	int listen_fd, rc = -1;
+
+	listen_fd = open_socket(path);
+	if (listen_fd == -1)
+		return -1;
+
+	memset(samples, 0, sizeof(samples));
+	if (alloc_history(&hist, history) || alloc_sample(&samples[0]) ||
+	    alloc_sample(&samples[1]))
+		goto out;
+
+	sample1 = &samples[0];
+	sample2 = &samples[1];
+
+	interval_timer_start(&timer, interval);
+	if (read_stats(sample1))
+		goto out;
+
+	pfd.fd = listen_fd;
+	pfd.events = POLLIN;
+
+	while (!intr) {
+		interval_timer_advance(&timer);
+		while (!intr) {
+			int left = interval_timer_remaining(&timer);
+
+			if (!left)
+				break;
+
+			if (poll(&pfd, 1, left) > 0)
+				serve_clients(listen_fd, &hist, interval);
+		}
+
+		if (intr)
+			break;
+
+		update_topology();
+		if (read_stats(sample2))
+			goto out;
+
+		/* Someone turned the statistics off, turn them back on */
+		if (stats_off) {
+			fprintf(stderr, "Dispatch statistics were disabled, enabling them again\n");
+			if (init_stats(true, false) || read_stats(sample1))
+				goto out;
+			continue;
+		}
+
+		add_history(&hist, sample1, sample2);
+
+		tmp = sample2;
+		sample2 = sample1;
+		sample1 = tmp;
+	}
+
+	rc = 0;
+out:
+	close(listen_fd);
+	unlink(path);
+	free_history(&hist);
+	free(samples[0].stats);
+	free(samples[1].stats);
+	return rc;
+}
+
 static void sighandler(int signum)
 {
 	intr = 1;
@@ -354,10 +937,17 @@ static void usage(void)
 	       "\t-d, --disable         Disable gathering statistics.\n"
 	       "\t-n, --numeric         Display the statistics in numbers, rather than percentage.\n"
 	       "\t-r, --raw             Display the raw counts, rather than the difference in an interval.\n"
+	       "\t-a, --aggregate <lvl> Sum the statistics by core, chip or node.\n"
+	       "\t-t, --top <n>         Only display the n cpus, or aggregates, with the highest\n"
+	       "\t                      share of dispatches on a far numa node.\n"
+	       "\t-D, --daemon <path>   Keep gathering statistics in the background and serve\n"
+	       "\t                      them over the Unix socket at path.\n"
 	       "\t-h, --help            Show this message and exit.\n"
 	       "\t-V, --version         Display vcpustat version information.\n"
-	       "\tinterval              The interval parameter specifies the amount of time between each report.\n"
-	       "\tcount                 The count parameter specifies how many reports will be displayed.\n");
+	       "\tinterval              The interval parameter specifies the amount of time between each report,\n"
+	       "\t                      in seconds. Fractions (0.5) and a ms suffix (100ms) are accepted.\n"
+	       "\tcount                 The count parameter specifies how many reports will be displayed,\n"
+	       "\t                      or with -D, how many intervals are kept.\n");
 }
 
 static struct option long_opts[] = {
@@ -367,16 +957,21 @@ static struct option long_opts[] = {
 	{"disable",	no_argument,		NULL,	'd'},
 	{"numeric",	no_argument,		NULL,	'n'},
 	{"raw",		no_argument,		NULL,	'r'},
+	{"aggregate",	required_argument,	NULL,	'a'},
+	{"top",		required_argument,	NULL,	't'},
+	{"daemon",	required_argument,	NULL,	'D'},
 	{0, 0, 0, 0},
 };
 
 int main(int argc, char *argv[])
 {
 	bool enable_only = false, disable_only = false;
+	char *socket_path = NULL;
 	int platform = get_platform();
-	int interval = 0, count = 0;
+	long long interval = 0;
+	int count = 0;
 	struct sigaction sa;
-	int c, opt_idx = 0;
+	int c, opt_idx = 0, rc = 0;
 
 	if (platform != PLATFORM_PSERIES_LPAR ||
 			access(VCPUSTAT_FILE, F_OK) == -1) {
@@ -389,7 +984,7 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
-	while ((c = getopt_long(argc, argv, "Vhnred",
+	while ((c = getopt_long(argc, argv, "Vhnreda:t:D:",
 				long_opts, &opt_idx)) != -1) {
 		switch (c) {
 		case 'V':
@@ -413,14 +1008,41 @@ int main(int argc, char *argv[])
 		case 'r':
 			raw_stats = 1;
 			break;
+		case 'a':
+			if (!strcmp(optarg, "core")) {
+				aggregate = AGGREGATE_CORE;
+			} else if (!strcmp(optarg, "chip")) {
+				aggregate = AGGREGATE_CHIP;
+			} else if (!strcmp(optarg, "node")) {
+				aggregate = AGGREGATE_NODE;
+			} else if (strcmp(optarg, "cpu")) {
+				fprintf(stderr, "Invalid aggregation level %s\n",
+					optarg);
+				return -1;
+			}
+			break;
+		case 't':
+			top_n = atoi(optarg);
+			if (top_n <= 0) {
+				fprintf(stderr, "Invalid top count %s\n", optarg);
+				return -1;
+			}
+			break;
+		case 'D':
+			socket_path = optarg;
+			break;
 		default:
 			break;
 		}
 	}
 
 	/* see if there is an interval specified */
-	if (optind < argc)
-		interval = atoi(argv[optind++]);
+	if (optind < argc) {
+		if (parse_interval(argv[optind++], &interval)) {
+			fprintf(stderr, "Invalid interval/count specified\n");
+			return -1;
+		}
+	}
 
 	/* check for count specified */
 	if (optind < argc)
@@ -436,7 +1058,8 @@ int main(int argc, char *argv[])
 		return -1;
 	}
 
-	if ((enable_only || disable_only) && (raw_stats || numeric_stats || interval)) {
+	if ((enable_only || disable_only) &&
+	    (raw_stats || numeric_stats || interval || socket_path)) {
 		fprintf(stderr, "-e|-d cannot be used with other options\n");
 		return -1;
 	}
@@ -444,7 +1067,20 @@ int main(int argc, char *argv[])
 	if (enable_only || disable_only)
 		return init_stats(enable_only, true);
 
-	if (!interval) {
+	nr_cpus = cpu_topology_init() ? NR_CPUS : topology_nr_cpus();
+
+	rows = calloc(nr_cpus, sizeof(*rows));
+	if (!rows) {
+		fprintf(stderr, "Error allocating memory for stats\n");
+		return -1;
+	}
+
+	if (socket_path) {
+		if (!interval)
+			interval = DAEMON_INTERVAL;
+		if (!count)
+			count = DAEMON_HISTORY;
+	} else if (!interval) {
 		display_raw_counts();
 		return 0;
 	}
@@ -453,7 +1089,8 @@ int main(int argc, char *argv[])
 	sigemptyset(&sa.sa_mask);
 	sa.sa_handler = sighandler;
 
-	if (sigaction(SIGINT, &sa, NULL) == -1) {
+	if (sigaction(SIGINT, &sa, NULL) == -1 ||
+	    sigaction(SIGTERM, &sa, NULL) == -1) {
 		fprintf(stderr, "Unable to setup signal handler\n");
 		return -1;
 	}
@@ -461,9 +1098,12 @@ int main(int argc, char *argv[])
 	if (init_stats(true, false))
 		return -1;
 
-	process_stats(interval, count);
+	if (socket_path)
+		rc = run_daemon(socket_path, interval, count);
+	else
+		process_stats(interval, count);
 
 	disable_stats();
 
-	return 0;
+	return rc;
 }